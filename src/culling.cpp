@@ -0,0 +1,198 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cstdio>
+
+Frustum Frustum::FromMatrix(const glm::mat4& viewProj)
+{
+    // Gribb & Hartmann, rows of the matrix (GLM is column major)
+    // Clip volume is 0 <= z <= w (glClipControl)
+    glm::mat4 m = glm::transpose(viewProj);
+    Frustum f;
+    f.planes[0] = m[3] + m[0];  // Left
+    f.planes[1] = m[3] - m[0];  // Right
+    f.planes[2] = m[3] + m[1];  // Bottom
+    f.planes[3] = m[3] - m[1];  // Top
+    f.planes[4] = m[2];         // z >= 0 (far with reverse-Z)
+    f.planes[5] = m[3] - m[2];  // z <= w (near with reverse-Z)
+    for(glm::vec4& p : f.planes)
+    {
+        // Infinite far plane has no normal, everything is inside of it
+        float length = glm::length(glm::vec3(p));
+        if(length < 1e-6f) p = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        else p /= length;
+    }
+    return f;
+}
+
+bool Frustum::Intersects(const glm::vec4& sphere) const
+{
+    glm::vec3 center = glm::vec3(sphere);
+    for(const glm::vec4& p : planes)
+    {
+        if(glm::dot(glm::vec3(p), center) + p.w < -sphere.w)
+            return false;
+    }
+    return true;
+}
+
+glm::vec4 TransformSphere(const glm::vec4& sphere, const glm::mat4& model)
+{
+    glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f));
+    float scale = std::max({glm::length(glm::vec3(model[0])),
+                            glm::length(glm::vec3(model[1])),
+                            glm::length(glm::vec3(model[2]))});
+    return glm::vec4(center, sphere.w * scale);
+}
+
+float ProjectedRadius(const glm::vec4& sphere, const glm::vec3& cameraPos,
+                      float fovY, float viewportHeight)
+{
+    glm::vec3 toCenter = glm::vec3(sphere) - cameraPos;
+    float distSqr = glm::dot(toCenter, toCenter) - sphere.w * sphere.w;
+    if(distSqr <= 0.0f) return std::numeric_limits<float>::infinity();
+    // Tangent of the silhouette cone over the tangent of the half FOV
+    float tanCone = sphere.w / std::sqrt(distSqr);
+    return tanCone / std::tan(fovY * 0.5f) * viewportHeight * 0.5f;
+}
+
+bool CullCounter::Test(const glm::vec4& sphere, std::span<const Frustum> frusta)
+{
+    bool isVisible = std::any_of(frusta.begin(), frusta.end(),
+                                 [&](const Frustum& f) { return f.Intersects(sphere); });
+    if(isVisible) visible++;
+    else culled++;
+    return isVisible;
+}
+
+OcclusionQueriesGL::OcclusionQueriesGL()
+{
+    // Unit cube, only the positions are used (other attributes are constant)
+    const std::array<glm::vec3, 8> vertices =
+    {
+        glm::vec3(-1, -1, -1), glm::vec3( 1, -1, -1),
+        glm::vec3(-1,  1, -1), glm::vec3( 1,  1, -1),
+        glm::vec3(-1, -1,  1), glm::vec3( 1, -1,  1),
+        glm::vec3(-1,  1,  1), glm::vec3( 1,  1,  1)
+    };
+    // Counter-clockwise from the outside
+    const std::array<uint32_t, 36> indices =
+    {
+        0, 2, 1,  1, 2, 3,  // -Z
+        4, 5, 6,  5, 7, 6,  // +Z
+        0, 4, 2,  2, 4, 6,  // -X
+        1, 3, 5,  3, 7, 5,  // +X
+        0, 1, 4,  1, 5, 4,  // -Y
+        2, 6, 3,  3, 6, 7   // +Y
+    };
+    indexCount = GLuint(indices.size());
+
+    glGenBuffers(1, &vBufferId);
+    glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+    glBufferStorage(GL_ARRAY_BUFFER, sizeof(vertices), vertices.data(), 0);
+    glGenBuffers(1, &iBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices.data(), 0);
+
+    glGenVertexArrays(1, &vaoId);
+    glBindVertexArray(vaoId);
+    glBindVertexBuffer(0, vBufferId, 0, GLsizei(sizeof(glm::vec3)));
+    glEnableVertexAttribArray(MeshGL::IN_POS);
+    glVertexAttribFormat(MeshGL::IN_POS, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexAttribBinding(MeshGL::IN_POS, 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glGenQueries(GLsizei(MAX_QUERIES), queryIds.data());
+}
+
+void OcclusionQueriesGL::Resolve(CullCounter& counter)
+{
+    for(uint32_t i = 0; i < MAX_QUERIES; i++)
+    {
+        if(!issued[i]) continue;
+        issued[i] = false;
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(queryIds[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) continue;
+
+        GLuint anyPassed = GL_FALSE;
+        glGetQueryObjectuiv(queryIds[i], GL_QUERY_RESULT, &anyPassed);
+        if(anyPassed) counter.visible++;
+        else counter.culled++;
+    }
+}
+
+glm::mat4 OcclusionQueriesGL::ProxyModel(const glm::vec4& sphere)
+{
+    glm::mat4 model = glm::mat4(sphere.w);
+    model[3] = glm::vec4(glm::vec3(sphere), 1.0f);
+    return model;
+}
+
+bool OcclusionQueriesGL::NeedsQuery(const glm::vec4& sphere, const glm::vec3& cameraPos,
+                                    float zNear)
+{
+    glm::vec3 d = glm::abs(cameraPos - glm::vec3(sphere));
+    float extent = sphere.w + zNear * 2.0f;
+    return (d.x > extent || d.y > extent || d.z > extent);
+}
+
+void OcclusionQueriesGL::Begin(uint32_t query)
+{
+    assert(query < MAX_QUERIES);
+    issued[query] = true;
+    glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, queryIds[query]);
+}
+
+void OcclusionQueriesGL::End(uint32_t)
+{
+    glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+}
+
+void OcclusionQueriesGL::DrawProxy() const
+{
+    glBindVertexArray(vaoId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    glDrawElements(GL_TRIANGLES, GLsizei(indexCount), GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+}
+
+void OcclusionQueriesGL::BeginConditional(uint32_t query) const
+{
+    assert(query < MAX_QUERIES);
+    if(!issued[query]) return;
+    // Draws anyway if the result is not ready when the GPU gets here
+    glBeginConditionalRender(queryIds[query], GL_QUERY_NO_WAIT);
+}
+
+void OcclusionQueriesGL::EndConditional(uint32_t query) const
+{
+    assert(query < MAX_QUERIES);
+    if(!issued[query]) return;
+    glEndConditionalRender();
+}
+
+void CullStats::Reset()
+{
+    view = CullCounter{};
+    shadow = CullCounter{};
+    occlusion = CullCounter{};
+}
+
+void CullStats::PrintSummaryIfChanged()
+{
+    char buffer[192];
+    std::snprintf(buffer, sizeof(buffer),
+                  "View: %u visible, %u culled | Shadow: %u visible, %u culled | "
+                  "Occlusion: %u visible, %u occluded",
+                  view.visible, view.culled, shadow.visible, shadow.culled,
+                  occlusion.visible, occlusion.culled);
+    if(lastSummary == buffer) return;
+    lastSummary = buffer;
+    std::printf("[Culling] %s\n", buffer);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <string>
+#include <cstdint>
+
+#include "utility.h"
+
+// CPU side visibility culling
+//
+// Bodies are tested as bounding spheres (see "MeshGL::boundingSphere")
+// against the camera frustum and the cascade volumes of the shadow pass,
+// draws of the culled ones are not issued at all.
+struct Frustum
+{
+    // Normalized planes (xyz: normal, w: distance), inside is positive
+    std::array<glm::vec4, 6> planes;
+
+    // Planes of the clip volume of "viewProj" (perspective or orthographic,
+    // [0, 1] depth range), an infinite far plane never culls
+    static Frustum  FromMatrix(const glm::mat4& viewProj);
+    bool            Intersects(const glm::vec4& sphere) const;
+};
+
+// Object space bounding sphere to world space
+// (radius is scaled by the largest axis of "model")
+glm::vec4 TransformSphere(const glm::vec4& sphere, const glm::mat4& model);
+// Radius (in pixels) of the sphere's silhouette on a viewport of "viewportHeight",
+// infinite when the camera is inside of the sphere
+float     ProjectedRadius(const glm::vec4& sphere, const glm::vec3& cameraPos,
+                          float fovY, float viewportHeight);
+
+struct CullCounter
+{
+    uint32_t    visible = 0;
+    uint32_t    culled  = 0;
+
+    // Counts & returns true if the sphere intersects any of the frusta
+    bool        Test(const glm::vec4& sphere, std::span<const Frustum> frusta);
+};
+
+// Hardware occlusion queries
+//
+// After the occluders are drawn, a bounding box proxy of each queried body
+// is rasterized against the depth buffer (no color/depth writes). The draw
+// of the body is then wrapped in a conditional render, so the GPU skips it
+// (vertex & fragment shading) when no sample of the proxy passed.
+// Results are not waited on (GL_QUERY_NO_WAIT), they are read back
+// a frame later only for statistics.
+struct OcclusionQueriesGL
+{
+    static constexpr uint32_t MAX_QUERIES = 8;
+
+    GLuint      vBufferId   = 0;    // Unit cube [-1, 1]
+    GLuint      iBufferId   = 0;
+    GLuint      vaoId       = 0;
+    GLuint      indexCount  = 0;
+    std::array<GLuint, MAX_QUERIES> queryIds    = {};
+    // Query is issued this frame, conditional render uses it
+    std::array<bool, MAX_QUERIES>   issued      = {};
+
+    // Constructors, Movement & Destructor
+                        OcclusionQueriesGL();
+                        OcclusionQueriesGL(const OcclusionQueriesGL&) = delete;
+                        OcclusionQueriesGL(OcclusionQueriesGL&&);
+    OcclusionQueriesGL& operator=(const OcclusionQueriesGL&) = delete;
+    OcclusionQueriesGL& operator=(OcclusionQueriesGL&&);
+                        ~OcclusionQueriesGL();
+
+    // Counts the available results of the previous frame's queries
+    // into "counter" (non-blocking), then clears the issued flags
+    void        Resolve(CullCounter& counter);
+    // Model matrix of the proxy box that encloses the sphere
+    static glm::mat4 ProxyModel(const glm::vec4& sphere);
+    // Proxies are not drawn when the camera is inside of them
+    // (box would be clipped by the near plane)
+    static bool NeedsQuery(const glm::vec4& sphere, const glm::vec3& cameraPos, float zNear);
+    void        Begin(uint32_t query);
+    void        End(uint32_t query);
+    void        DrawProxy() const;
+    // No-op if the query is not issued this frame (body is drawn)
+    void        BeginConditional(uint32_t query) const;
+    void        EndConditional(uint32_t query) const;
+};
+
+// Per-frame counts of each pass, for profiling
+struct CullStats
+{
+    CullCounter view;
+    CullCounter shadow;
+    CullCounter occlusion;          // Results of the previous frame
+    std::string lastSummary;
+
+    void        Reset();
+    // Prints the counts if they differ from the previous frame
+    void        PrintSummaryIfChanged();
+};
+
+inline OcclusionQueriesGL::OcclusionQueriesGL(OcclusionQueriesGL&& other)
+    : vBufferId(other.vBufferId)
+    , iBufferId(other.iBufferId)
+    , vaoId(other.vaoId)
+    , indexCount(other.indexCount)
+    , queryIds(other.queryIds)
+    , issued(other.issued)
+{
+    other.vBufferId = 0;
+    other.iBufferId = 0;
+    other.vaoId = 0;
+    other.queryIds.fill(0);
+}
+
+inline OcclusionQueriesGL& OcclusionQueriesGL::operator=(OcclusionQueriesGL&& other)
+{
+    assert(this != &other);
+    if(vaoId) glDeleteVertexArrays(1, &vaoId);
+    if(vBufferId) glDeleteBuffers(1, &vBufferId);
+    if(iBufferId) glDeleteBuffers(1, &iBufferId);
+    if(queryIds[0]) glDeleteQueries(GLsizei(MAX_QUERIES), queryIds.data());
+    vBufferId = other.vBufferId;
+    iBufferId = other.iBufferId;
+    vaoId = other.vaoId;
+    indexCount = other.indexCount;
+    queryIds = other.queryIds;
+    issued = other.issued;
+    other.vBufferId = 0;
+    other.iBufferId = 0;
+    other.vaoId = 0;
+    other.queryIds.fill(0);
+    return *this;
+}
+
+inline OcclusionQueriesGL::~OcclusionQueriesGL()
+{
+    if(vaoId) glDeleteVertexArrays(1, &vaoId);
+    if(vBufferId) glDeleteBuffers(1, &vBufferId);
+    if(iBufferId) glDeleteBuffers(1, &iBufferId);
+    if(queryIds[0]) glDeleteQueries(GLsizei(MAX_QUERIES), queryIds.data());
+}
@@ -0,0 +1,102 @@
+#include "filewatch.h"
+
+#include <cstdio>
+#include <array>
+#include <algorithm>
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+FileWatcher::FileWatcher(const std::string& dir)
+    : directory(dir)
+{
+    #ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(inotifyFd >= 0)
+        {
+            // Editors either write in place or write a temporary
+            // file and rename it over the original
+            watchId = inotify_add_watch(inotifyFd, directory.c_str(),
+                                        IN_CLOSE_WRITE | IN_MOVED_TO);
+        }
+        if(watchId >= 0)
+        {
+            std::printf("Watching \"%s\" (inotify).\n", directory.c_str());
+            return;
+        }
+        std::printf("[WARNING]: Unable to use inotify on \"%s\", "
+                    "falling back to polling.\n", directory.c_str());
+        if(inotifyFd >= 0) close(inotifyFd);
+        inotifyFd = -1;
+    #endif
+
+    ScanTimes(nullptr);
+    lastPoll = Clock::now();
+    std::printf("Watching \"%s\" (polling).\n", directory.c_str());
+}
+
+FileWatcher::~FileWatcher()
+{
+    #ifdef __linux__
+        if(inotifyFd >= 0) close(inotifyFd);
+    #endif
+}
+
+void FileWatcher::ScanTimes(std::vector<std::string>* changed)
+{
+    std::error_code err;
+    for(const auto& entry : std::filesystem::directory_iterator(directory, err))
+    {
+        if(!entry.is_regular_file(err)) continue;
+
+        std::string path = directory + "/" + entry.path().filename().string();
+        auto time = entry.last_write_time(err);
+        if(err) continue;
+
+        auto [it, inserted] = fileTimes.try_emplace(path, time);
+        if(!inserted && it->second != time)
+        {
+            it->second = time;
+            if(changed) changed->push_back(path);
+        }
+        else if(inserted && changed) changed->push_back(path);
+    }
+}
+
+std::vector<std::string> FileWatcher::Poll()
+{
+    std::vector<std::string> changed;
+
+    #ifdef __linux__
+    if(inotifyFd >= 0)
+    {
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        for(;;)
+        {
+            ssize_t size = read(inotifyFd, buffer.data(), buffer.size());
+            if(size <= 0) break;
+
+            for(ssize_t i = 0; i < size;)
+            {
+                const auto* e = reinterpret_cast<const inotify_event*>(buffer.data() + i);
+                if(e->len > 0) changed.push_back(directory + "/" + e->name);
+                i += ssize_t(sizeof(inotify_event) + e->len);
+            }
+        }
+    }
+    else
+    #endif
+    {
+        if(Clock::now() - lastPoll < POLL_INTERVAL) return changed;
+        lastPoll = Clock::now();
+        ScanTimes(&changed);
+    }
+
+    // Single save may generate multiple events
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
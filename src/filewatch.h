@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+
+// Watches the files of a single directory (non-recursive).
+// Uses inotify on Linux, other platforms poll the modification
+// times of the files periodically.
+struct FileWatcher
+{
+    using Clock = std::chrono::steady_clock;
+    // Modification times are checked this often on the fallback path
+    static constexpr std::chrono::milliseconds POLL_INTERVAL{250};
+
+    std::string     directory;
+    int             inotifyFd   = -1;
+    int             watchId     = -1;
+    // Fallback
+    std::unordered_map<std::string, std::filesystem::file_time_type> fileTimes;
+    Clock::time_point lastPoll;
+
+    // Constructors, Movement & Destructor
+                    FileWatcher(const std::string& directory);
+                    FileWatcher(const FileWatcher&) = delete;
+                    FileWatcher(FileWatcher&&) = delete;
+    FileWatcher&    operator=(const FileWatcher&) = delete;
+    FileWatcher&    operator=(FileWatcher&&) = delete;
+                    ~FileWatcher();
+
+    // Non-blocking, returns the files ("directory/name") that are
+    // written since the last call (each file is reported once)
+    std::vector<std::string>    Poll();
+
+    private:
+    void                        ScanTimes(std::vector<std::string>* changed);
+};
@@ -0,0 +1,455 @@
+#include "framegraph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+size_t FormatByteSize(GLenum format)
+{
+    switch(format)
+    {
+        case GL_R8:                 return 1;
+        case GL_R16F:
+        case GL_RG8:
+        case GL_DEPTH_COMPONENT16:  return 2;
+        case GL_RGB8:               return 3;
+        case GL_RGBA16F:
+        case GL_RG32F:              return 8;
+        case GL_RGBA32F:            return 16;
+        // R32F, RG16F, RGBA8, DEPTH24(_STENCIL8), DEPTH32F...
+        default:                    return 4;
+    }
+}
+
+size_t TextureByteSize(const FGTextureDesc& d)
+{
+    size_t size = 0;
+    int32_t w = d.width, h = d.height;
+    for(int32_t i = 0; i < d.levels; i++)
+    {
+        size += size_t(w) * size_t(h) * size_t(d.layers) * FormatByteSize(d.format);
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+    return size;
+}
+
+GLuint CreateTexture(const FGTextureDesc& d)
+{
+    GLenum target = (d.layers > 1) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(target, textureId);
+    if(d.layers > 1)
+        glTexStorage3D(target, d.levels, d.format, d.width, d.height, d.layers);
+    else
+        glTexStorage2D(target, d.levels, d.format, d.width, d.height);
+
+    GLenum minFilter = d.filter;
+    if(d.levels > 1)
+        minFilter = (d.filter == GL_LINEAR) ? GL_LINEAR_MIPMAP_LINEAR
+                                            : GL_NEAREST_MIPMAP_NEAREST;
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GLint(minFilter));
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GLint(d.filter));
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GLint(d.wrap));
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GLint(d.wrap));
+    if(d.wrap == GL_CLAMP_TO_BORDER)
+    {
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, borderColor);
+    }
+    if(d.compare != GL_NONE)
+    {
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GLint(d.compare));
+        glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+    glBindTexture(target, 0);
+    return textureId;
+}
+
+}
+
+FGHandle FGBuilder::Create(const std::string& name, const FGTextureDesc& desc)
+{
+    // Empty storage is a GL error (and the pass would have no FBO)
+    assert(desc.width > 0 && desc.height > 0);
+    graph.resources.push_back(FrameGraph::Resource
+    {
+        .name = name,
+        .desc = desc
+    });
+    graph.nodes.push_back(FrameGraph::Node
+    {
+        .resource = uint32_t(graph.resources.size() - 1)
+    });
+    return FGHandle(graph.nodes.size() - 1);
+}
+
+FGHandle FGBuilder::Read(FGHandle h)
+{
+    assert(h < graph.nodes.size());
+    FrameGraph::Pass& pass = graph.passes[passIndex];
+    if(std::find(pass.reads.cbegin(), pass.reads.cend(), h) == pass.reads.cend())
+    {
+        pass.reads.push_back(h);
+        graph.nodes[h].readCount++;
+    }
+    return h;
+}
+
+FGHandle FGBuilder::Write(FGHandle h)
+{
+    assert(h < graph.nodes.size());
+    // Previous contents may be loaded, so the previous version is also read
+    // (this also orders write-after-write)
+    if(graph.nodes[h].producer != FrameGraph::NONE) Read(h);
+
+    graph.nodes.push_back(FrameGraph::Node
+    {
+        .resource = graph.nodes[h].resource,
+        .producer = passIndex
+    });
+    FGHandle newHandle = FGHandle(graph.nodes.size() - 1);
+    graph.passes[passIndex].writes.push_back(newHandle);
+    return newHandle;
+}
+
+FGHandle FGBuilder::WriteColor(FGHandle h, uint32_t slot)
+{
+    assert(slot < FrameGraph::MAX_COLOR_ATTACHMENTS);
+    FGHandle newHandle = Write(h);
+    graph.passes[passIndex].colors[slot] = newHandle;
+    return newHandle;
+}
+
+FGHandle FGBuilder::WriteDepth(FGHandle h)
+{
+    FGHandle newHandle = Write(h);
+    graph.passes[passIndex].depth = newHandle;
+    return newHandle;
+}
+
+void FGBuilder::SideEffect()
+{
+    graph.passes[passIndex].sideEffect = true;
+}
+
+FrameGraph::~FrameGraph()
+{
+    for(const auto& [key, fbo] : fboCache)
+        glDeleteFramebuffers(1, &fbo);
+    for(const PooledTexture& t : pool)
+        glDeleteTextures(1, &t.textureId);
+}
+
+void FrameGraph::Reset()
+{
+    resources.clear();
+    nodes.clear();
+    passes.clear();
+    order.clear();
+}
+
+FGHandle FrameGraph::Import(const std::string& name, GLuint textureId,
+                            const FGTextureDesc& desc)
+{
+    resources.push_back(Resource
+    {
+        .name = name,
+        .desc = desc,
+        .imported = true,
+        .textureId = textureId
+    });
+    nodes.push_back(Node{.resource = uint32_t(resources.size() - 1)});
+    return FGHandle(nodes.size() - 1);
+}
+
+FGHandle FrameGraph::ImportBackbuffer(const std::string& name,
+                                      int32_t width, int32_t height)
+{
+    FGHandle h = Import(name, 0, FGTextureDesc{.width = width, .height = height});
+    resources.back().backbuffer = true;
+    return h;
+}
+
+void FrameGraph::AddPass(const std::string& name, const SetupFunc& setup,
+                         ExecuteFunc execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    pass.colors.fill(FG_INVALID);
+    passes.push_back(std::move(pass));
+
+    FGBuilder builder = {*this, uint32_t(passes.size() - 1)};
+    setup(builder);
+}
+
+void FrameGraph::Compile()
+{
+    // ================ //
+    //      CULLING     //
+    // ================ //
+    // Backbuffer versions have an implicit external reader
+    std::vector<uint32_t> readCounts(nodes.size());
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        readCounts[i] = nodes[i].readCount;
+        if(resources[nodes[i].resource].backbuffer &&
+           nodes[i].producer != NONE) readCounts[i]++;
+    }
+    std::vector<FGHandle> unreferenced;
+    for(size_t i = 0; i < nodes.size(); i++)
+        if(readCounts[i] == 0 && nodes[i].producer != NONE)
+            unreferenced.push_back(FGHandle(i));
+
+    for(Pass& p : passes)
+    {
+        p.refCount = uint32_t(p.writes.size()) + (p.sideEffect ? 1u : 0u);
+        p.culled = false;
+    }
+    while(!unreferenced.empty())
+    {
+        FGHandle h = unreferenced.back();
+        unreferenced.pop_back();
+
+        Pass& producer = passes[nodes[h].producer];
+        if(--producer.refCount != 0) continue;
+
+        producer.culled = true;
+        for(FGHandle r : producer.reads)
+            if(--readCounts[r] == 0 && nodes[r].producer != NONE)
+                unreferenced.push_back(r);
+    }
+
+    // ================ //
+    //     ORDERING     //
+    // ================ //
+    // Topological sort (Kahn), ties are broken by declaration order
+    std::vector<uint32_t> inDegree(passes.size(), 0);
+    std::vector<std::vector<uint32_t>> dependents(passes.size());
+    for(uint32_t i = 0; i < passes.size(); i++)
+    {
+        if(passes[i].culled) continue;
+        for(FGHandle r : passes[i].reads)
+        {
+            uint32_t producer = nodes[r].producer;
+            if(producer == NONE || producer == i) continue;
+            dependents[producer].push_back(i);
+            inDegree[i]++;
+        }
+    }
+    order.clear();
+    std::vector<uint32_t> ready;
+    for(uint32_t i = 0; i < passes.size(); i++)
+        if(!passes[i].culled && inDegree[i] == 0) ready.push_back(i);
+    while(!ready.empty())
+    {
+        auto it = std::min_element(ready.begin(), ready.end());
+        uint32_t p = *it;
+        ready.erase(it);
+        order.push_back(p);
+        for(uint32_t d : dependents[p])
+            if(--inDegree[d] == 0) ready.push_back(d);
+    }
+
+    // ================ //
+    //    ALLOCATION    //
+    // ================ //
+    for(Resource& r : resources)
+    {
+        r.firstUse = NONE;
+        r.lastUse = NONE;
+    }
+    for(uint32_t i = 0; i < order.size(); i++)
+    {
+        const Pass& p = passes[order[i]];
+        auto Touch = [&](FGHandle h)
+        {
+            Resource& r = resources[nodes[h].resource];
+            if(r.firstUse == NONE) r.firstUse = i;
+            r.lastUse = i;
+        };
+        for(FGHandle h : p.reads) Touch(h);
+        for(FGHandle h : p.writes) Touch(h);
+    }
+
+    for(PooledTexture& t : pool) t.inUse = false;
+    std::vector<bool> pooledThisFrame(pool.size(), false);
+    stats = Stats{};
+    for(uint32_t i = 0; i < order.size(); i++)
+    {
+        // Acquire
+        for(Resource& r : resources)
+        {
+            if(r.imported || r.firstUse != i) continue;
+
+            auto it = std::find_if(pool.begin(), pool.end(),
+                                   [&](const PooledTexture& t)
+            {
+                return !t.inUse && t.desc == r.desc;
+            });
+            if(it == pool.end())
+            {
+                pool.push_back(PooledTexture
+                {
+                    .desc = r.desc,
+                    .textureId = CreateTexture(r.desc)
+                });
+                pooledThisFrame.push_back(false);
+                it = pool.end() - 1;
+            }
+            it->inUse = true;
+            it->idleFrames = 0;
+            r.textureId = it->textureId;
+
+            size_t poolIndex = size_t(it - pool.begin());
+            if(!pooledThisFrame[poolIndex])
+            {
+                pooledThisFrame[poolIndex] = true;
+                stats.physicalCount++;
+                stats.physicalBytes += TextureByteSize(r.desc);
+            }
+            stats.transientCount++;
+            stats.transientBytes += TextureByteSize(r.desc);
+        }
+        // Release
+        for(const Resource& r : resources)
+        {
+            if(r.imported || r.lastUse != i) continue;
+            for(PooledTexture& t : pool)
+                if(t.textureId == r.textureId) t.inUse = false;
+        }
+    }
+
+    // Delete the textures that are not used for a while
+    bool poolChanged = false;
+    for(size_t i = 0; i < pool.size(); i++)
+    {
+        if(pooledThisFrame[i]) continue;
+        if(++pool[i].idleFrames < POOL_MAX_IDLE_FRAMES) continue;
+        glDeleteTextures(1, &pool[i].textureId);
+        pool[i].textureId = 0;
+        poolChanged = true;
+    }
+    if(poolChanged)
+    {
+        std::erase_if(pool, [](const PooledTexture& t) { return t.textureId == 0; });
+        // Cached FBOs may refer to the deleted textures
+        for(const auto& [key, fbo] : fboCache)
+            glDeleteFramebuffers(1, &fbo);
+        fboCache.clear();
+    }
+
+    // ================ //
+    //   FRAMEBUFFERS   //
+    // ================ //
+    for(uint32_t passIndex : order)
+    {
+        Pass& p = passes[passIndex];
+        p.fbo = 0;
+        p.width = p.height = 0;
+
+        bool toBackbuffer = false;
+        std::vector<GLuint> key;
+        auto AddAttachment = [&](FGHandle h)
+        {
+            const Resource& r = resources[nodes[h].resource];
+            toBackbuffer |= r.backbuffer;
+            if(p.width == 0)
+            {
+                p.width = r.desc.width;
+                p.height = r.desc.height;
+            }
+            key.push_back(r.textureId);
+        };
+        for(FGHandle h : p.colors)
+        {
+            if(h != FG_INVALID) AddAttachment(h);
+            else key.push_back(0);
+        }
+        if(p.depth != FG_INVALID) AddAttachment(p.depth);
+        else key.push_back(0);
+
+        // Pass does not render (compute, uploads etc.)
+        if(p.width == 0 || toBackbuffer) continue;
+
+        auto it = fboCache.find(key);
+        if(it != fboCache.end())
+        {
+            p.fbo = it->second;
+            continue;
+        }
+
+        glGenFramebuffers(1, &p.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, p.fbo);
+        std::array<GLenum, MAX_COLOR_ATTACHMENTS> drawBuffers;
+        for(uint32_t slot = 0; slot < MAX_COLOR_ATTACHMENTS; slot++)
+        {
+            drawBuffers[slot] = GL_NONE;
+            if(p.colors[slot] == FG_INVALID) continue;
+
+            drawBuffers[slot] = GL_COLOR_ATTACHMENT0 + slot;
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + slot,
+                                 Texture(p.colors[slot]), 0);
+        }
+        glDrawBuffers(GLsizei(MAX_COLOR_ATTACHMENTS), drawBuffers.data());
+        if(p.depth != FG_INVALID)
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                 Texture(p.depth), 0);
+
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if(status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::fprintf(stderr, "Framebuffer of pass \"%s\" is incomplete (0x%X)!\n",
+                         p.name.c_str(), status);
+            std::exit(EXIT_FAILURE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        fboCache.emplace(key, p.fbo);
+    }
+
+    stats.passCount = uint32_t(passes.size());
+    stats.culledPasses = uint32_t(passes.size() - order.size());
+}
+
+void FrameGraph::Execute()
+{
+    for(uint32_t passIndex : order)
+    {
+        const Pass& p = passes[passIndex];
+        if(p.width != 0)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, p.fbo);
+            glViewport(0, 0, p.width, p.height);
+        }
+        p.execute(*this);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameGraph::PrintSummaryIfChanged()
+{
+    std::string summary = "Passes:";
+    for(uint32_t passIndex : order)
+        summary += " " + passes[passIndex].name;
+    if(stats.culledPasses != 0)
+    {
+        summary += " | Culled:";
+        for(const Pass& p : passes)
+            if(p.culled) summary += " " + p.name;
+    }
+    if(summary == lastSummary) return;
+    lastSummary = summary;
+
+    std::printf("[FrameGraph] %s\n"
+                "[FrameGraph] Transient: %u textures (%.2f MiB), "
+                "Physical: %u textures (%.2f MiB)\n",
+                summary.c_str(),
+                stats.transientCount, double(stats.transientBytes) / (1024.0 * 1024.0),
+                stats.physicalCount, double(stats.physicalBytes) / (1024.0 * 1024.0));
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "utility.h"
+
+// Frame graph
+//
+// Each frame, passes are declared with the textures they read and the
+// attachments they write. "Compile" orders the passes by their dependencies,
+// culls the passes that do not contribute to the backbuffer (or to a pass
+// with side effects) and assigns physical textures to the transient
+// resources. Transient resources whose lifetimes do not overlap and whose
+// descriptions match share the same GL texture (aliasing).
+//
+// Usage (every frame);
+//  graph.Reset();
+//  FGHandle bb = graph.ImportBackbuffer("Backbuffer", w, h);
+//  graph.AddPass("Name", [&](FGBuilder& b) { ... }, [&](const FrameGraph& fg) { ... });
+//  graph.Compile();
+//  graph.Execute();
+using FGHandle = uint32_t;
+static constexpr FGHandle FG_INVALID = UINT32_MAX;
+
+struct FGTextureDesc
+{
+    int32_t width   = 0;
+    int32_t height  = 0;
+    int32_t layers  = 1;            // More than one creates GL_TEXTURE_2D_ARRAY
+    int32_t levels  = 1;
+    GLenum  format  = GL_RGBA8;
+    GLenum  filter  = GL_NEAREST;
+    GLenum  wrap    = GL_CLAMP_TO_EDGE; // Border color is white when clamped to border
+    GLenum  compare = GL_NONE;      // GL_COMPARE_REF_TO_TEXTURE for shadow samplers
+
+    bool operator==(const FGTextureDesc&) const = default;
+};
+
+struct FrameGraph;
+
+// Given to the setup function of a pass to declare its resources
+struct FGBuilder
+{
+    FrameGraph& graph;
+    uint32_t    passIndex;
+
+    // New transient texture, only valid during this frame
+    FGHandle    Create(const std::string& name, const FGTextureDesc&);
+    // Sampled (or otherwise read) by this pass
+    FGHandle    Read(FGHandle);
+    // Attachments of the pass' framebuffer, these return the new version
+    // of the resource which must be used by later passes.
+    FGHandle    WriteColor(FGHandle, uint32_t slot = 0);
+    FGHandle    WriteDepth(FGHandle);
+    // Written without being attached (i.e. image store, compute)
+    FGHandle    Write(FGHandle);
+    // Pass will never be culled
+    void        SideEffect();
+};
+
+struct FrameGraph
+{
+    using SetupFunc   = std::function<void(FGBuilder&)>;
+    using ExecuteFunc = std::function<void(const FrameGraph&)>;
+
+    static constexpr uint32_t MAX_COLOR_ATTACHMENTS = 4;
+    static constexpr uint32_t NONE = UINT32_MAX;
+    // Pooled textures that are unused this many frames are deleted
+    static constexpr uint32_t POOL_MAX_IDLE_FRAMES = 120;
+
+    struct Resource
+    {
+        std::string     name;
+        FGTextureDesc   desc;
+        bool            imported    = false;
+        bool            backbuffer  = false;
+        GLuint          textureId   = 0;        // Physical texture (valid after "Compile")
+        uint32_t        firstUse    = NONE;     // Execution order indices
+        uint32_t        lastUse     = NONE;
+    };
+    // Each write creates a new version (node) of a resource
+    struct Node
+    {
+        uint32_t        resource;
+        uint32_t        producer    = NONE;
+        uint32_t        readCount   = 0;
+    };
+    struct Pass
+    {
+        std::string     name;
+        ExecuteFunc     execute;
+        std::vector<FGHandle>   reads;
+        std::vector<FGHandle>   writes;
+        std::array<FGHandle, MAX_COLOR_ATTACHMENTS> colors;
+        FGHandle        depth       = FG_INVALID;
+        bool            sideEffect  = false;
+        // Compile
+        uint32_t        refCount    = 0;
+        bool            culled      = false;
+        GLuint          fbo         = 0;
+        int32_t         width       = 0;
+        int32_t         height      = 0;
+    };
+    struct PooledTexture
+    {
+        FGTextureDesc   desc;
+        GLuint          textureId   = 0;
+        bool            inUse       = false;
+        uint32_t        idleFrames  = 0;
+    };
+    struct Stats
+    {
+        uint32_t        passCount       = 0;
+        uint32_t        culledPasses    = 0;
+        uint32_t        transientCount  = 0;
+        uint32_t        physicalCount   = 0;
+        size_t          transientBytes  = 0; // Without aliasing
+        size_t          physicalBytes   = 0; // Actually allocated for this frame
+    };
+
+    std::vector<Resource>       resources;
+    std::vector<Node>           nodes;
+    std::vector<Pass>           passes;
+    std::vector<uint32_t>       order;      // Execution order of the non-culled passes
+    std::vector<PooledTexture>  pool;
+    std::map<std::vector<GLuint>, GLuint> fboCache;
+    Stats                       stats;
+    std::string                 lastSummary;
+
+    // Constructors, Movement & Destructor
+                FrameGraph() = default;
+                FrameGraph(const FrameGraph&) = delete;
+                FrameGraph(FrameGraph&&) = delete;
+    FrameGraph& operator=(const FrameGraph&) = delete;
+    FrameGraph& operator=(FrameGraph&&) = delete;
+                ~FrameGraph();
+
+    void        Reset();
+    // Externally owned texture, its contents live across frames
+    FGHandle    Import(const std::string& name, GLuint textureId, const FGTextureDesc&);
+    // Default framebuffer, writing to it binds FBO 0
+    FGHandle    ImportBackbuffer(const std::string& name, int32_t width, int32_t height);
+    // "setup" is called immediately, "execute" is called by "Execute"
+    void        AddPass(const std::string& name, const SetupFunc& setup,
+                        ExecuteFunc execute);
+    void        Compile();
+    void        Execute();
+
+    // Physical texture of a resource, only valid while executing
+    GLuint      Texture(FGHandle) const;
+    const FGTextureDesc& Desc(FGHandle) const;
+    // Prints the executed passes and memory usage
+    // if it differs from the previous frame
+    void        PrintSummaryIfChanged();
+};
+
+inline GLuint FrameGraph::Texture(FGHandle h) const
+{
+    assert(h < nodes.size());
+    return resources[nodes[h].resource].textureId;
+}
+
+inline const FGTextureDesc& FrameGraph::Desc(FGHandle h) const
+{
+    assert(h < nodes.size());
+    return resources[nodes[h].resource].desc;
+}
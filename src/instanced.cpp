@@ -0,0 +1,267 @@
+#include "instanced.h"
+
+#include <glm/ext.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BODIES_SSE2
+#include <emmintrin.h>
+#endif
+
+void GenerateAsteroidBelt(std::vector<SmallBody>& bodies,
+                          uint32_t count, float innerRadius, float outerRadius,
+                          uint32_t layerCount, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> thickness(0.0f, 0.35f);
+
+    bodies.clear();
+    bodies.reserve(count);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        float r = glm::mix(innerRadius, outerRadius, unit(rng));
+        glm::vec3 axis = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f;
+        if(glm::dot(axis, axis) < 1e-4f) axis = glm::vec3(0, 1, 0);
+
+        bodies.push_back(SmallBody
+        {
+            .orbitRadius = r,
+            .orbitPhase  = unit(rng) * glm::two_pi<float>(),
+            // Inner bodies orbit faster (Kepler, ~r^-1.5)
+            .orbitSpeed  = 2.0f / (r * std::sqrt(r)),
+            .height      = thickness(rng),
+            .oscAmplitude = 0.1f * unit(rng), //abc
+            .oscFrequency = glm::mix(0.2f, 1.0f, unit(rng)),
+            .scale       = glm::mix(0.03f, 0.15f, unit(rng) * unit(rng)),
+            .spinSpeed   = glm::mix(-2.0f, 2.0f, unit(rng)),
+            .spinAxis    = glm::normalize(axis),
+            .layer       = uint32_t(unit(rng) * float(layerCount)) % layerCount
+        });
+    }
+}
+
+namespace
+{
+
+BodyInstance AnimateBody(const SmallBody& b, double simTime)
+{
+    const double TwoPi = glm::two_pi<double>();
+    double orbit = double(b.orbitPhase) + simTime * double(b.orbitSpeed);
+    float angle  = float(std::fmod(orbit, TwoPi));
+    float spin   = float(std::fmod(simTime * double(b.spinSpeed), TwoPi));
+    float osc    = float(std::fmod(double(b.orbitPhase) + simTime * double(b.oscFrequency), TwoPi));
+    float height = b.height + b.oscAmplitude * std::sin(osc);
+
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::rotate(model, angle, glm::vec3(0, 1, 0));
+    model = glm::translate(model, glm::vec3(b.orbitRadius, height, 0.0f));
+    model = glm::rotate(model, spin, b.spinAxis);
+    model = glm::scale(model, glm::vec3(b.scale));
+
+    return BodyInstance
+    {
+        .transform = model,
+        .layer     = b.layer,
+        .ambient   = 0.05f,
+        .specular  = 0.1f,
+        .shininess = 8.0f
+    };
+}
+
+#ifdef BODIES_SSE2
+// Quadrants of "SinCos4" are int32, angles beyond that are wrapped
+// like "AnimateBody" does (rare, only after very long sim times)
+inline __m128d WrapLargeAngles(__m128d angle)
+{
+    const __m128d Limit = _mm_set1_pd(1073741824.0 * glm::half_pi<double>()); // 2^30 quadrants
+    __m128d absAngle = _mm_andnot_pd(_mm_set1_pd(-0.0), angle);
+    if(_mm_movemask_pd(_mm_cmplt_pd(absAngle, Limit)) == 0x3) return angle;
+
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, angle);
+    lanes[0] = std::fmod(lanes[0], glm::two_pi<double>());
+    lanes[1] = std::fmod(lanes[1], glm::two_pi<double>());
+    return _mm_load_pd(lanes);
+}
+
+// Sine & cosine of "phase + speed * t" for 4 bodies. The angle is reduced
+// to [-pi/4, pi/4] in double precision (sim time grows without bound),
+// the polynomials are single precision (Cephes, ~1 ulp on that range).
+void SinCos4(__m128 phase, __m128 speed, double t, __m128& sinOut, __m128& cosOut)
+{
+    const __m128d T         = _mm_set1_pd(t);
+    const __m128d InvPiHalf = _mm_set1_pd(2.0 / glm::pi<double>());
+    const __m128d PiHalf    = _mm_set1_pd(glm::half_pi<double>());
+
+    // Quadrant & remainder, 2 bodies per double register
+    __m128d angleLo = _mm_add_pd(_mm_cvtps_pd(phase), _mm_mul_pd(_mm_cvtps_pd(speed), T));
+    __m128d angleHi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(phase, phase)),
+                                 _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(speed, speed)), T));
+    angleLo = WrapLargeAngles(angleLo);
+    angleHi = WrapLargeAngles(angleHi);
+    __m128i qLo = _mm_cvtpd_epi32(_mm_mul_pd(angleLo, InvPiHalf)); // Rounds to nearest
+    __m128i qHi = _mm_cvtpd_epi32(_mm_mul_pd(angleHi, InvPiHalf));
+    angleLo = _mm_sub_pd(angleLo, _mm_mul_pd(_mm_cvtepi32_pd(qLo), PiHalf));
+    angleHi = _mm_sub_pd(angleHi, _mm_mul_pd(_mm_cvtepi32_pd(qHi), PiHalf));
+    __m128  x = _mm_movelh_ps(_mm_cvtpd_ps(angleLo), _mm_cvtpd_ps(angleHi));
+    __m128i q = _mm_unpacklo_epi64(qLo, qHi);
+
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 s = _mm_add_ps(_mm_mul_ps(x2, _mm_set1_ps(-1.9515295891e-4f)), _mm_set1_ps(8.3321608736e-3f));
+    s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(-1.6666654611e-1f));
+    s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, x2), x), x);
+    __m128 c = _mm_add_ps(_mm_mul_ps(x2, _mm_set1_ps(2.443315711809948e-5f)), _mm_set1_ps(-1.388731625493765e-3f));
+    c = _mm_add_ps(_mm_mul_ps(c, x2), _mm_set1_ps(4.166664568298827e-2f));
+    c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, x2), x2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x2, _mm_set1_ps(0.5f))));
+
+    // Quadrants 1 & 3 swap the two, sin is negated on 2 & 3, cos on 1 & 2
+    const __m128i One = _mm_set1_epi32(1);
+    __m128  swap    = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, One), One));
+    __m128  sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+    __m128  cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, One), _mm_set1_epi32(2)), 30));
+    sinOut = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sinSign);
+    cosOut = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cosSign);
+}
+
+// Transposes one column of 4 matrices (x, y, z, w of each body in a
+// register) and stores it to the instances
+inline void StoreColumn(BodyInstance* out, int column, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(&out[0].transform[column][0], x);
+    _mm_storeu_ps(&out[1].transform[column][0], y);
+    _mm_storeu_ps(&out[2].transform[column][0], z);
+    _mm_storeu_ps(&out[3].transform[column][0], w);
+}
+
+// Same as "AnimateBody" for "b[0..3]",
+//  rotate(angle, Y) * translate(radius, height, 0) * rotate(spin, axis) * scale(k)
+// is expanded into its 12 non-constant terms, each one a register of 4 bodies
+void AnimateBodies4(BodyInstance* out, const SmallBody* b, double simTime)
+{
+    #define GATHER(field) _mm_setr_ps(b[0].field, b[1].field, b[2].field, b[3].field)
+    __m128 radius = GATHER(orbitRadius);
+    __m128 phase  = GATHER(orbitPhase);
+    __m128 k      = GATHER(scale);
+    __m128 ux     = GATHER(spinAxis.x);
+    __m128 uy     = GATHER(spinAxis.y);
+    __m128 uz     = GATHER(spinAxis.z);
+    __m128 sa, ca, ss, cs, so, co;
+    SinCos4(phase, GATHER(orbitSpeed), simTime, sa, ca);
+    SinCos4(_mm_setzero_ps(), GATHER(spinSpeed), simTime, ss, cs);
+    SinCos4(phase, GATHER(oscFrequency), simTime, so, co);
+    __m128 height = _mm_add_ps(GATHER(height), _mm_mul_ps(GATHER(oscAmplitude), so));
+    #undef GATHER
+
+    // Spin (same terms as glm::rotate), scaled by k
+    __m128 oneMinusC = _mm_sub_ps(_mm_set1_ps(1.0f), cs);
+    __m128 tx = _mm_mul_ps(oneMinusC, ux);
+    __m128 ty = _mm_mul_ps(oneMinusC, uy);
+    __m128 tz = _mm_mul_ps(oneMinusC, uz);
+    __m128 sx = _mm_mul_ps(ss, ux);
+    __m128 sy = _mm_mul_ps(ss, uy);
+    __m128 sz = _mm_mul_ps(ss, uz);
+    __m128 r[3][3] =
+    {
+        {_mm_add_ps(cs, _mm_mul_ps(tx, ux)), _mm_add_ps(_mm_mul_ps(tx, uy), sz), _mm_sub_ps(_mm_mul_ps(tx, uz), sy)},
+        {_mm_sub_ps(_mm_mul_ps(ty, ux), sz), _mm_add_ps(cs, _mm_mul_ps(ty, uy)), _mm_add_ps(_mm_mul_ps(ty, uz), sx)},
+        {_mm_add_ps(_mm_mul_ps(tz, ux), sy), _mm_sub_ps(_mm_mul_ps(tz, uy), sx), _mm_add_ps(cs, _mm_mul_ps(tz, uz))}
+    };
+
+    // Orbit rotation around Y, (x, y, z) -> (c * x + s * z, y, c * z - s * x)
+    const __m128 Zero = _mm_setzero_ps();
+    for(int i = 0; i < 3; i++)
+    {
+        __m128 x = _mm_mul_ps(r[i][0], k);
+        __m128 y = _mm_mul_ps(r[i][1], k);
+        __m128 z = _mm_mul_ps(r[i][2], k);
+        StoreColumn(out, i,
+                    _mm_add_ps(_mm_mul_ps(ca, x), _mm_mul_ps(sa, z)),
+                    y,
+                    _mm_sub_ps(_mm_mul_ps(ca, z), _mm_mul_ps(sa, x)),
+                    Zero);
+    }
+    StoreColumn(out, 3,
+                _mm_mul_ps(ca, radius),
+                height,
+                _mm_sub_ps(Zero, _mm_mul_ps(sa, radius)),
+                _mm_set1_ps(1.0f));
+
+    for(int i = 0; i < 4; i++)
+    {
+        out[i].layer     = b[i].layer;
+        out[i].ambient   = 0.05f;
+        out[i].specular  = 0.1f;
+        out[i].shininess = 8.0f;
+    }
+}
+#endif
+
+}
+
+void AnimateBodies(std::vector<BodyInstance>& instances,
+                   const std::vector<SmallBody>& bodies, double simTime)
+{
+    instances.resize(bodies.size());
+    size_t i = 0;
+#ifdef BODIES_SSE2
+    for(; i + 4 <= bodies.size(); i += 4)
+        AnimateBodies4(&instances[i], &bodies[i], simTime);
+#endif
+    for(; i < bodies.size(); i++)
+        instances[i] = AnimateBody(bodies[i], simTime);
+}
+
+void AnimateBodiesReference(std::vector<BodyInstance>& instances,
+                            const std::vector<SmallBody>& bodies, double simTime)
+{
+    instances.resize(bodies.size());
+    for(size_t i = 0; i < bodies.size(); i++)
+        instances[i] = AnimateBody(bodies[i], simTime);
+}
+
+InstancedBodiesGL::InstancedBodiesGL(uint32_t cap)
+    : capacity(cap)
+{
+    glGenBuffers(1, &sBufferId);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sBufferId);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+                    GLsizeiptr(std::max(capacity, 1u) * sizeof(BodyInstance)),
+                    nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InstancedBodiesGL::Upload(const std::vector<BodyInstance>& instances)
+{
+    if(instances.size() > capacity)
+    {
+        std::fprintf(stderr, "Instance count (%zu) exceeds the capacity (%u)!\n",
+                     instances.size(), capacity);
+        std::exit(EXIT_FAILURE);
+    }
+    instanceCount = uint32_t(instances.size());
+    if(instanceCount == 0) return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sBufferId);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    GLsizeiptr(instanceCount * sizeof(BodyInstance)),
+                    instances.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InstancedBodiesGL::Draw(const MeshGL& mesh) const
+{
+    if(instanceCount == 0) return;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_INSTANCES, sBufferId);
+    glBindVertexArray(mesh.vaoId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.iBufferId);
+    glDrawElementsInstanced(GL_TRIANGLES, GLsizei(mesh.indexCount),
+                            GL_UNSIGNED_INT, nullptr, GLsizei(instanceCount));
+    glBindVertexArray(0);
+}
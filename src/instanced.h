@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "utility.h"
+
+// Per-instance data of the instanced body renderer.
+// Layout must match "BodyInstance" (std430) at "instanced.vert".
+struct BodyInstance
+{
+    glm::mat4   transform;
+    uint32_t    layer;      // Layer of the albedo texture array
+    float       ambient;
+    float       specular;
+    float       shininess;
+};
+static_assert(sizeof(BodyInstance) == 80, "BodyInstance must match std430 layout!");
+
+// Orbital parameters of a single small body (asteroid, ring particle)
+// These stay on the CPU, "AnimateBodies" turns them into "BodyInstance"s.
+// Height bobs around the orbit plane;
+//  y(t) = height + oscAmplitude * sin(oscFrequency * t + orbitPhase)
+struct SmallBody
+{
+    float       orbitRadius;
+    float       orbitPhase;
+    float       orbitSpeed;
+    float       height;
+    float       oscAmplitude;
+    float       oscFrequency;
+    float       scale;
+    float       spinSpeed;
+    glm::vec3   spinAxis;
+    uint32_t    layer;
+};
+
+void GenerateAsteroidBelt(std::vector<SmallBody>& bodies,
+                          uint32_t count, float innerRadius, float outerRadius,
+                          uint32_t layerCount, uint32_t seed);
+// Writes the transforms of "bodies" at "simTime" to "instances"
+// (relative to the belt's center, angles are wrapped in double precision).
+// Evaluates 4 bodies at a time with SSE2 where available, the spin axes
+// must be normalized.
+void AnimateBodies(std::vector<BodyInstance>& instances,
+                   const std::vector<SmallBody>& bodies, double simTime);
+// Same as "AnimateBodies" with chained glm transforms, one body at a time
+// (reference of "--bench-transforms")
+void AnimateBodiesReference(std::vector<BodyInstance>& instances,
+                            const std::vector<SmallBody>& bodies, double simTime);
+
+struct InstancedBodiesGL
+{
+    // This must match the SSBO binding at "instanced.vert"
+    static constexpr GLuint SSBO_INSTANCES = 0;
+
+    GLuint      sBufferId       = 0;
+    uint32_t    capacity        = 0;
+    uint32_t    instanceCount   = 0;
+    // Constructors, Movement & Destructor
+                        InstancedBodiesGL(uint32_t capacity);
+                        InstancedBodiesGL(const InstancedBodiesGL&) = delete;
+                        InstancedBodiesGL(InstancedBodiesGL&&);
+    InstancedBodiesGL&  operator=(const InstancedBodiesGL&) = delete;
+    InstancedBodiesGL&  operator=(InstancedBodiesGL&&);
+                        ~InstancedBodiesGL();
+
+    void    Upload(const std::vector<BodyInstance>& instances);
+    // Issues a single instanced draw of "mesh" for all uploaded instances
+    void    Draw(const MeshGL& mesh) const;
+};
+
+inline InstancedBodiesGL::InstancedBodiesGL(InstancedBodiesGL&& other)
+    : sBufferId(other.sBufferId)
+    , capacity(other.capacity)
+    , instanceCount(other.instanceCount)
+{
+    other.sBufferId = 0;
+}
+
+inline InstancedBodiesGL& InstancedBodiesGL::operator=(InstancedBodiesGL&& other)
+{
+    assert(this != &other);
+    if(sBufferId) glDeleteBuffers(1, &sBufferId);
+    sBufferId = other.sBufferId;
+    capacity = other.capacity;
+    instanceCount = other.instanceCount;
+    other.sBufferId = 0;
+    return *this;
+}
+
+inline InstancedBodiesGL::~InstancedBodiesGL()
+{
+    if(sBufferId) glDeleteBuffers(1, &sBufferId);
+}
@@ -1,9 +1,22 @@
 #include <cstdio>
+#include <cmath>
 #include <array>
+#include <chrono>
+#include <string_view>
+#include <optional>
 
 #include <iostream>
 
 #include "utility.h"
+#include "instanced.h"
+#include "framegraph.h"
+#include "shaderlib.h"
+#include "filewatch.h"
+#include "shadows.h"
+#include "culling.h"
+#include "starfield.h"
+#include "terrain.h"
+#include "scene.h"
 
 #include <GLFW/glfw3.h>
 
@@ -67,7 +80,7 @@ void MouseScrollCallback(GLFWwindow* wnd, double dx, double dy)
         front.z = sin(glm::radians(state->yaw)) * cos(glm::radians(state->pitch));
         glm::vec3 forward = glm::normalize(front);
 
-        state->pos += forward * (float)dy * zoomSpeed; 
+        state->pos += glm::dvec3(forward) * (dy * double(zoomSpeed)); 
     }
     
     else {
@@ -109,78 +122,85 @@ void KeyboardCallback(GLFWwindow* wnd, int key, int scancode, int action, int mo
         state->SimSpeed -= changeSpeed;
         if(state->SimSpeed < minSimSpeed) state->SimSpeed = minSimSpeed;
     }
+
+    // Shadow filter quality (tap count), lit shaders are recompiled
+    if(key == GLFW_KEY_Q) state->shadowQuality = (state->shadowQuality + 1) % uint32_t(ShadowQuality::COUNT);
+    // Shadow map / EVSM / analytic sphere occluders
+    if(key == GLFW_KEY_T) state->shadowMode = (state->shadowMode + 1) % uint32_t(ShadowMode::COUNT);
 }
 
-void assignMoonMatrix(GLState &state, float CurrentSimTime, int type, float orbitSize, float orbitSpeed, float scale){
-    
-    glm::mat4 model;
-
-    if (type == 0){ 
-        // moon
-        model = glm::mat4(1.0f); 
-        model = glm::rotate(model, CurrentSimTime * orbitSpeed, glm::vec3(0, 1, 0));
-        model = glm::translate(model, glm::vec3(orbitSize, 1.0f * sin(CurrentSimTime * 0.7f), 0.0f)); // It oscillates(kind of)
-        model = glm::scale(model, glm::vec3(scale));
-        state.moonModel = model;
-        state.moonVec  = glm::vec3(state.moonModel[3]);
-    }
-    else if (type == 1){ 
-        //jupiter
-        model = state.moonModel;
-        model = glm::rotate(model, CurrentSimTime * orbitSpeed, glm::vec3(0, 1, 0));
-        model = glm::translate(model, glm::vec3(orbitSize, 0.5 * sin(CurrentSimTime * 0.6f) + 0.25 * sin(CurrentSimTime * 1.2f), 0.0f)); // It oscillates(kind of)
-        model = glm::scale(model, glm::vec3(scale)); // recall that this scale is wrt. to Moon, not Earth
-        state.jupiterModel = model;
-        state.jupiterVec = glm::vec3(state.jupiterModel[3]);
-    }
-    else if (type == 2){ 
-        //sun
-        model = glm::mat4(1.0f);
-        model = glm::rotate(model, CurrentSimTime * orbitSpeed, glm::vec3(0, 1, 0));
-        model = glm::translate(model, glm::vec3(orbitSize, 5 * sin(CurrentSimTime * 0.3) + 3 * cos(CurrentSimTime * 0.15) , 0.0f)); // It oscillates(kind of)
-        model = glm::scale(model, glm::vec3(scale));
-        state.sunModel = model;
-        state.sunVec = glm::vec3(state.sunModel[3]);    
-    }
+// Angle of a constant rotation, wrapped in double precision
+// so that the float angle stays exact for long simulation times
+float rotationAngle(double simTime, double speed){
+    return float(std::fmod(simTime * speed, glm::two_pi<double>()));
 }
 
-void drawEarth(GLState& state, const MeshGL& mesh, const TextureGL& daytexture,const TextureGL& nighttexture, const TextureGL& specTex,GLuint vShaderId, GLuint fShaderId, glm::mat4 model, glm::mat4 view, glm::mat4 proj, float simTime,GLuint shadowMapTexId){
-  
-    const float spinSpeed = 0.5f; //abc 
+// Bodies spin around their own Y axis (see "BodyOrbit::spinSpeed")
+glm::mat4 spinModel(glm::mat4 model, double simTime, double spinSpeed){
+    return glm::rotate(model, rotationAngle(simTime, spinSpeed), glm::vec3(0, 1, 0));
+}
+
+void drawEarth(GLState& state, const MeshGL& mesh, const TextureGL& daytexture,const TextureGL& nighttexture, const TextureGL& specTex,const ShaderProgram& shader, glm::mat4 model, glm::mat4 view, glm::mat4 proj, double simTime, double spinSpeed, GLuint shadowMapTexId){
+    // Variant is still compiling
+    if(!shader.ready) return;
 
-    glm::mat4 finalModel = glm::rotate(model, simTime * spinSpeed, glm::vec3(0, 1, 0));
+    glm::mat4 finalModel = spinModel(model, simTime, spinSpeed);
     glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(finalModel)));
 
 
-    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, vShaderId);
-    glActiveShaderProgram(state.renderPipeline, vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
     
     glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(finalModel));
-    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
-    glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(normalMat));
-    glUniform1ui(4, state.mode); 
+    // Depth only variant outputs world positions (cascades are in the UBO),
+    // tessellated one outputs the patch corners in world space
+    bool tessellated = (shader.tcShaderId != 0);
+    if (shader.variant != ShaderVariant::SHADOW_DEPTH && !tessellated){
+        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+        glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(normalMat));
+    }
+
+    if (tessellated){
+        glm::vec4 sphere = TransformSphere(mesh.boundingSphere, finalModel);
+        // Scale is uniform, the normalized basis is the rotation
+        glm::mat3 worldToObject = glm::transpose(glm::mat3(glm::normalize(glm::vec3(finalModel[0])),
+                                                           glm::normalize(glm::vec3(finalModel[1])),
+                                                           glm::normalize(glm::vec3(finalModel[2]))));
+
+        glUseProgramStages(state.renderPipeline, GL_TESS_CONTROL_SHADER_BIT, shader.tcShaderId);
+        glActiveShaderProgram(state.renderPipeline, shader.tcShaderId);
+        glUniform4fv(0, 1, glm::value_ptr(sphere));
+        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+        glUniform1f(3, float(state.height));
+
+        glUseProgramStages(state.renderPipeline, GL_TESS_EVALUATION_SHADER_BIT, shader.teShaderId);
+        glActiveShaderProgram(state.renderPipeline, shader.teShaderId);
+        glUniform4fv(0, 1, glm::value_ptr(sphere));
+        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+        glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(worldToObject));
+    }
 
-    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, fShaderId);
-    glActiveShaderProgram(state.renderPipeline, fShaderId);
-    glUniform1ui(0, state.mode); 
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
 
-    if (state.mode == 2){
-   
-        glm::vec3 lightDirection = glm::normalize(state.sunVec); 
+    if (shader.variant != ShaderVariant::SHADOW_DEPTH){
     
-        glUniform3fv(1, 1, glm::value_ptr(lightDirection)); 
-        glUniformMatrix4fv(5, 1, GL_FALSE, glm::value_ptr(state.lightSpaceMatrix)); 
-        glm::vec3 camPos = state.pos;
+        glm::vec3 lightDir = state.lightDir; 
+    
+        glUniform3fv(1, 1, glm::value_ptr(lightDir)); 
+        glm::vec3 camPos = glm::vec3(glm::inverse(view)[3]);
         glUniform3fv(2,1,glm::value_ptr(camPos));
-        glUniform1ui(6, 1u);
     }
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, daytexture.textureId);
 
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, shadowMapTexId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTexId);
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, nighttexture.textureId);
@@ -190,44 +210,96 @@ void drawEarth(GLState& state, const MeshGL& mesh, const TextureGL& daytexture,c
 
     glBindVertexArray(mesh.vaoId);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.iBufferId);
-    glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, nullptr);
+    if (tessellated){
+        // Each triangle of the icosphere is a patch
+        glPatchParameteri(GL_PATCH_VERTICES, 3);
+        glDrawElements(GL_PATCHES, GLsizei(mesh.indexCount), GL_UNSIGNED_INT, nullptr);
+        // Other draws do not bind these stages
+        glUseProgramStages(state.renderPipeline,
+                           GL_TESS_CONTROL_SHADER_BIT | GL_TESS_EVALUATION_SHADER_BIT, 0);
+    }
+    else glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, nullptr);
     glBindVertexArray(0);
 
 }
 
+// Chunks are selected by "TerrainGL::Update" with the same (spun) model
+void drawTerrain(GLState& state, const TerrainGL& terrain, const TextureGL& daytexture, const TextureGL& nighttexture, const TextureGL& specTex, const ShaderProgram& shader, glm::mat4 finalModel, glm::mat4 view, glm::mat4 proj, GLuint shadowMapTexId){
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    glm::vec3 cameraObject = glm::vec3(glm::inverse(finalModel) * glm::vec4(cameraPos, 1.0f));
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(finalModel));
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+    glUniform3fv(3, 1, glm::value_ptr(cameraObject));
+    glUniform1f(4, TerrainGL::HEIGHT_SCALE);
+
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
+    glm::vec3 lightDir = state.lightDir;
+    glUniform3fv(1, 1, glm::value_ptr(lightDir));
+    glUniform3fv(2, 1, glm::value_ptr(cameraPos));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, daytexture.textureId);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTexId);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, nighttexture.textureId);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, specTex.textureId);
+    glActiveTexture(GL_TEXTURE0 + TerrainGL::T_TILES);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.tileArrayId);
+
+    // Skirts are seen from both sides
+    glDisable(GL_CULL_FACE);
+    terrain.Draw();
+    glEnable(GL_CULL_FACE);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
 void drawClouds(GLState& state,
                 const MeshGL& mesh,
                 const TextureGL& cloudTex,
-                GLuint vShaderId,
-                GLuint fShaderId,
+                const ShaderProgram& shader,
                 glm::mat4 earthModel,
                 glm::mat4 view,
                 glm::mat4 proj,
-                float simTime)
+                double simTime)
 {
-    const float cloudSpeed = 0.8f;
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+    const double cloudSpeed = 0.8;
     glm::mat4 model = earthModel;
     model = glm::scale(model, glm::vec3(1.02f));
-    model = glm::rotate(model, simTime * cloudSpeed, glm::vec3(0,1,0));
+    model = glm::rotate(model, rotationAngle(simTime, cloudSpeed), glm::vec3(0,1,0));
 
     glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(model)));
 
     // vertex shader
-    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, vShaderId);
-    glActiveShaderProgram(state.renderPipeline, vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
     glUniformMatrix4fv(0,1,false,glm::value_ptr(model));
     glUniformMatrix4fv(1,1,false,glm::value_ptr(view));
     glUniformMatrix4fv(2,1,false,glm::value_ptr(proj));
     glUniformMatrix3fv(3,1,false,glm::value_ptr(normalMat));
-    glUniform1ui(4,4); // <<<<<< cloud mode
 
     // fragment shader
-    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, fShaderId);
-    glActiveShaderProgram(state.renderPipeline, fShaderId);
-    glUniform1ui(0,4);
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
 
     // light
-    glm::vec3 lightDir = normalize(state.sunVec);
+    glm::vec3 lightDir = state.lightDir;
     glUniform3fv(1,1,glm::value_ptr(lightDir));
 
     // alpha blending
@@ -246,35 +318,35 @@ void drawClouds(GLState& state,
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
 }
-void drawMoon(GLState& state, const MeshGL& mesh, const TextureGL& texture, GLuint vShaderId, GLuint fShaderId, glm::mat4 model, glm::mat4 view, glm::mat4 proj, float simTime){
-  
-    const float spinSpeed = 1.5f; //abc
+void drawMoon(GLState& state, const MeshGL& mesh, const TextureGL& texture, const ShaderProgram& shader, glm::mat4 model, glm::mat4 view, glm::mat4 proj, double simTime, double spinSpeed){
+    // Variant is still compiling
+    if(!shader.ready) return;
 
-    glm::mat4 finalModel = glm::rotate(model, simTime * spinSpeed, glm::vec3(0, 1, 0));
+    glm::mat4 finalModel = spinModel(model, simTime, spinSpeed);
     glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(finalModel)));
 
-    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, vShaderId);
-    glActiveShaderProgram(state.renderPipeline, vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
 
     glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(finalModel));
-    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
-    glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(normalMat));
-    glUniform1ui(4, state.mode); 
+    // Depth only variant outputs world positions (cascades are in the UBO)
+    if (shader.variant != ShaderVariant::SHADOW_DEPTH){
+        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+        glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(normalMat));
+    }
 
-    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, fShaderId);
-    glActiveShaderProgram(state.renderPipeline, fShaderId);
-    glUniform1ui(0, state.mode); 
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
 
-    if (state.mode == 2){
+    if (shader.variant != ShaderVariant::SHADOW_DEPTH){
     
-        glm::vec3 lightDirection = glm::normalize(state.sunVec); 
+        glm::vec3 lightDir = state.lightDir; 
         
-        glUniform3fv(1, 1, glm::value_ptr(lightDirection)); 
-        glUniformMatrix4fv(5, 1, GL_FALSE, glm::value_ptr(state.lightSpaceMatrix)); 
-        glm::vec3 camPos = state.pos;
+        glUniform3fv(1, 1, glm::value_ptr(lightDir)); 
+        glm::vec3 camPos = glm::vec3(glm::inverse(view)[3]);
         glUniform3fv(2,1,glm::value_ptr(camPos));
-        glUniform1ui(6, 0u);
     
     }
 
@@ -290,64 +362,358 @@ void drawMoon(GLState& state, const MeshGL& mesh, const TextureGL& texture, GLui
 
 }
 
-void drawBackground(GLState& state, const MeshGL& mesh, const TextureGL& texture, GLuint vShaderId, GLuint fShaderId, glm::mat4 view, glm::mat4 proj){
-    
+void drawInstancedBodies(GLState& state, const InstancedBodiesGL& bodies, const MeshGL& mesh, const TextureArrayGL& texture, const ShaderProgram& shader, glm::mat4 model, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
+
+    glm::vec3 lightDir = state.lightDir;
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    glUniform3fv(1, 1, glm::value_ptr(lightDir));
+    glUniform3fv(2, 1, glm::value_ptr(cameraPos));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture.textureId);
+
+    bodies.Draw(mesh);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Bodies of the scene without a pass of their own, one instanced draw
+// per mesh (not culled, they do not cast shadows)
+struct SceneInstances
+{
+    uint32_t                    mesh;
+    std::vector<uint32_t>       bodies;
+    std::vector<BodyInstance>   instances;  // Same size as "bodies"
+    InstancedBodiesGL           buffer;
+};
+
+void animateSceneInstances(SceneInstances& group, const SceneGraph& scene, const SceneAssets& assets, const std::vector<uint32_t>& textureLayers, glm::dvec3 origin, double simTime){
+    for(size_t i = 0; i < group.bodies.size(); i++){
+        uint32_t body = group.bodies[i];
+        const SceneMaterial& material = assets.materials[scene.materials[body]];
+        group.instances[i] = BodyInstance
+        {
+            .transform = spinModel(CameraRelative(scene.world[body], origin), simTime, scene.spinSpeed[body]),
+            .layer     = textureLayers[material.albedo],
+            .ambient   = material.ambient,
+            .specular  = material.specular,
+            .shininess = material.shininess
+        };
+    }
+    group.buffer.Upload(group.instances);
+}
+
+// Rasterizes the bounding box of "sphere" into the occlusion "query",
+// nothing is written to the framebuffer
+void drawOcclusionProxy(GLState& state, OcclusionQueriesGL& queries, const ShaderProgram& shader, uint32_t query, glm::vec4 sphere, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+    // Box would be clipped, body is drawn unconditionally
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    if(!OcclusionQueriesGL::NeedsQuery(sphere, cameraPos, 0.1f)) return;
+
+    glm::mat4 model = OcclusionQueriesGL::ProxyModel(sphere);
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+    glUniformMatrix3fv(3, 1, GL_FALSE, glm::value_ptr(glm::mat3(1.0f)));
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
     glDepthMask(GL_FALSE);
-    glDisable(GL_CULL_FACE);     
 
-    glm::mat4 skyView = glm::mat4(glm::mat3(view));
+    queries.Begin(query);
+    queries.DrawProxy();
+    queries.End(query);
 
-    glm::mat4 skyProj = glm::perspective(glm::radians(45.0f), (float)state.width / (float)state.height, 0.1f, 1000.0f);  // It is perspective but meets the conditions
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+}
 
-    glm::mat4 skyModel = glm::scale(glm::mat4(1.0f), glm::vec3(500.0f));
+// Renders the asteroid belt at 1k, 100k and 1M instances and reports
+// where the instanced path is bound. Each count is measured;
+//  - as is (baseline),
+//  - at quarter resolution (fragment load / 4),
+//  - with a denser mesh (vertex load * mesh ratio),
+//  - with per-frame CPU animation and upload of all instances.
+void runInstanceBenchmark(GLState& state, const MeshGL& mesh, const MeshGL& denseMesh, const TextureArrayGL& texture, const ShaderProgram& shader){
+
+    static constexpr std::array<uint32_t, 3> InstanceCounts = {1'000, 100'000, 1'000'000};
+    static constexpr int WarmupFrames  = 5;
+    static constexpr int MeasureFrames = 30;
+
+    struct Timing { double cpuMs = 0.0; double gpuMs = 0.0; };
+
+    glfwSwapInterval(0); // Do not measure the vsync
+
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    state.pos    = glm::dvec3(0.0, 35.0, 45.0);
+    state.lightDir = glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(state.pos), glm::vec3(0.0f), state.up);
+    glm::mat4 proj = PerspectiveReverseZ(glm::radians(45.0f), float(state.width) / float(state.height), 0.1f);
+
+    InstancedBodiesGL instanced = InstancedBodiesGL(InstanceCounts.back());
+    std::vector<SmallBody> bodies;
+    std::vector<BodyInstance> instances;
+
+    auto Measure = [&](const MeshGL& m, int vpWidth, int vpHeight, bool animate)
+    {
+        Timing t;
+        for(int frame = 0; frame < WarmupFrames + MeasureFrames; frame++)
+        {
+            auto cpuStart = std::chrono::steady_clock::now();
+            if(animate)
+            {
+                AnimateBodies(instances, bodies, double(frame) * 0.016);
+                instanced.Upload(instances);
+            }
+            glViewport(0, 0, vpWidth, vpHeight);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+            drawInstancedBodies(state, instanced, m, texture, shader, glm::mat4(1.0f), view, proj);
+            glEndQuery(GL_TIME_ELAPSED);
+            auto cpuEnd = std::chrono::steady_clock::now();
+
+            glfwSwapBuffers(state.window);
+            glfwPollEvents();
+
+            GLuint64 gpuNs = 0;
+            glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNs);
+            if(frame < WarmupFrames) continue;
+
+            t.cpuMs += std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count();
+            t.gpuMs += double(gpuNs) * 1e-6;
+        }
+        t.cpuMs /= MeasureFrames;
+        t.gpuMs /= MeasureFrames;
+        return t;
+    };
+
+    double vertexRatio = double(denseMesh.indexCount) / double(mesh.indexCount);
+    std::printf("\nInstanced body benchmark (%dx%d, %d frames each)\n",
+                state.width, state.height, MeasureFrames);
+    char denseHeader[32];
+    std::snprintf(denseHeader, sizeof(denseHeader), "gpu x%.1fv", vertexRatio);
+    std::printf("%9s | %9s | %9s | %9s | %9s | %9s | %s\n",
+                "instances", "gpu ms", "gpu 1/4px", denseHeader,
+                "cpu ms", "cpu anim", "bound");
+    for(uint32_t count : InstanceCounts)
+    {
+        GenerateAsteroidBelt(bodies, count, 22.0f, 30.0f, uint32_t(texture.layerCount), 477u);
+        AnimateBodies(instances, bodies, 0.0);
+        instanced.Upload(instances);
+
+        Timing base    = Measure(mesh, state.width, state.height, false);
+        Timing quarter = Measure(mesh, state.width / 2, state.height / 2, false);
+        Timing dense   = Measure(denseMesh, state.width, state.height, false);
+        Timing anim    = Measure(mesh, state.width, state.height, true);
+
+        // Normalized sensitivities, 1.0 means the cost scales fully with that load.
+        // Undefined if the timer resolved to 0 or the meshes are the same
+        // (scene file may use one mesh for both)
+        bool fragValid = (base.gpuMs > 0.0);
+        bool vertValid = (base.gpuMs > 0.0 && std::abs(vertexRatio - 1.0) > 1e-6);
+        double fragScale = fragValid ? (base.gpuMs - quarter.gpuMs) / (0.75 * base.gpuMs) : 0.0;
+        double vertScale = vertValid ? (dense.gpuMs / base.gpuMs - 1.0) / (vertexRatio - 1.0) : 0.0;
+        const char* bound = (anim.cpuMs > anim.gpuMs)   ? "CPU"
+                          : (!fragValid || !vertValid)  ? "n/a"
+                          : (vertScale >= fragScale)    ? "vertex"
+                                                        : "fragment";
+        char vertText[16] = "n/a", fragText[16] = "n/a";
+        if(vertValid) std::snprintf(vertText, sizeof(vertText), "%.2f", vertScale);
+        if(fragValid) std::snprintf(fragText, sizeof(fragText), "%.2f", fragScale);
+        std::printf("%9u | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f | %s (vtx %s, frag %s)\n",
+                    count, base.gpuMs, quarter.gpuMs, dense.gpuMs,
+                    base.cpuMs, anim.cpuMs, bound, vertText, fragText);
+    }
+
+    glDeleteQueries(1, &timerQuery);
+    glfwSwapInterval(1);
+}
+
+// CPU cost of the belt transforms, the batched "AnimateBodies" against
+// the chained glm transforms ("AnimateBodiesReference"). No window needed
+void runTransformBenchmark(){
+    const uint32_t BodyCounts[] = {1000, 100000, 1000000}; //abc
+    const int Repeats = 20; //abc Best of
+    const double SimTime = 86400.0 * 365.0; // Large enough for the angle reduction to matter
+
+    std::vector<SmallBody> bodies;
+    std::vector<BodyInstance> batched, reference;
+
+    auto Measure = [&](auto animate, std::vector<BodyInstance>& instances){
+        double best = 1e30;
+        for(int i = 0; i < Repeats; i++){
+            auto start = std::chrono::steady_clock::now();
+            animate(instances, bodies, SimTime + double(i) * 0.016);
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count());
+        }
+        return best;
+    };
+
+    std::printf("\nBody transform benchmark (best of %d)\n", Repeats);
+    std::printf("%9s | %11s | %11s | %7s | %s\n", "bodies", "glm us", "batched us", "speedup", "max error");
+    for(uint32_t count : BodyCounts)
+    {
+        GenerateAsteroidBelt(bodies, count, 22.0f, 30.0f, 2, 477u);
+        double referenceUs = Measure(AnimateBodiesReference, reference);
+        double batchedUs = Measure(AnimateBodies, batched);
+
+        // Both were last evaluated at the same time
+        float maxError = 0.0f;
+        for(size_t i = 0; i < bodies.size(); i++)
+            for(int c = 0; c < 4; c++)
+                for(int r = 0; r < 4; r++)
+                    maxError = std::max(maxError, std::abs(batched[i].transform[c][r] - reference[i].transform[c][r]));
+
+        std::printf("%9u | %11.1f | %11.1f | %6.2fx | %.2e\n",
+                    count, referenceUs, batchedUs, referenceUs / batchedUs, double(maxError));
+    }
+}
+
+// Sky is a single fullscreen triangle at the far plane, drawn after the
+// opaque geometry so that only the uncovered pixels are shaded
+void drawBackground(GLState& state, const CubemapGL& texture, const ShaderProgram& shader, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+    // Camera translation is irrelevant for the (infinitely far) sky
+    glm::mat4 invViewProj = glm::inverse(proj * glm::mat4(glm::mat3(view)));
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(invViewProj));
+
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
 
-    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, vShaderId);
-    glActiveShaderProgram(state.renderPipeline, vShaderId);
-    
-    glUniformMatrix4fv(0, 1, false, glm::value_ptr(skyModel)); 
-    glUniformMatrix4fv(1, 1, false, glm::value_ptr(skyView));  
-    glUniformMatrix4fv(2, 1, false, glm::value_ptr(skyProj));
-    glUniform1ui(4, state.mode);    
-
-    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, fShaderId);
-    glActiveShaderProgram(state.renderPipeline, fShaderId);
-    glUniform1ui(0, state.mode);
-    
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture.textureId);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture.textureId);
 
-    glBindVertexArray(mesh.vaoId);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.iBufferId);
+    // Depth is cleared to the far plane (0), covered pixels fail the test
+    glDepthFunc(GL_GEQUAL);
+    glDepthMask(GL_FALSE);
 
-    glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, nullptr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindVertexArray(state.emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
     glBindVertexArray(0);
 
     glDepthMask(GL_TRUE);
-    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_GREATER);
+}
+
+// Catalog stars are added over the glow, same depth setup as the sky
+void drawStars(GLState& state, const StarFieldGL& stars, const ShaderProgram& shader, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+    glm::mat4 viewProj = proj * glm::mat4(glm::mat3(view));
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+    glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(viewProj));
+
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthFunc(GL_GEQUAL);
+    glDepthMask(GL_FALSE);
+
+    glBindVertexArray(state.emptyVao);
+    stars.Draw();
+    glBindVertexArray(0);
+
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_GREATER);
+    glDisable(GL_BLEND);
+    glDisable(GL_PROGRAM_POINT_SIZE);
 }
 
-void drawSun(GLState& state, const MeshGL& mesh, const TextureGL& texture, GLuint vShaderId, GLuint fShaderId, glm::mat4 view, glm::mat4 proj, float simTime){  
+// Small bodies are a single quad, the sphere is ray-cast per fragment
+// ("impostor.vert" & the IMPOSTOR variants of "debug.frag").
+// "model" only orients the UVs, "sphere" is in the space of "view".
+void drawImpostor(GLState& state, const TextureGL& texture, const ShaderProgram& shader, glm::vec4 sphere, glm::mat4 model, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    glm::mat4 viewProj = proj * view;
+    glm::mat3 worldToObject = glm::transpose(glm::mat3(model));
+
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
+    glUniform4fv(0, 1, glm::value_ptr(sphere));
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(proj));
+
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
+    if(shader.variant != ShaderVariant::IMPOSTOR_EMISSIVE){
+        glm::vec3 lightDir = state.lightDir;
+        glUniform3fv(1, 1, glm::value_ptr(lightDir));
+    }
+    glUniform3fv(2, 1, glm::value_ptr(cameraPos));
+    glUniform4fv(4, 1, glm::value_ptr(sphere));
+    glUniformMatrix4fv(5, 1, GL_FALSE, glm::value_ptr(viewProj));
+    glUniformMatrix3fv(6, 1, GL_FALSE, glm::value_ptr(worldToObject));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture.textureId);
+
+    glBindVertexArray(state.emptyVao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void drawSun(GLState& state, const MeshGL& mesh, const TextureGL& texture, const ShaderProgram& shader, glm::mat4 model, glm::mat4 view, glm::mat4 proj){
+    // Variant is still compiling
+    if(!shader.ready) return;
+  
     
     //glDepthMask(GL_FALSE);
     //glDisable(GL_CULL_FACE); // We have worried about if it is too far so we disabled just for the sun
 
-    glm::mat4 sunView = glm::mat4(glm::mat3(view));
-    glm::mat4 sunProj = glm::perspective(glm::radians(45.0f), (float)state.width / state.height, 0.1f, 1000.0f); // It is perspective but meets the conditions
-
-    glm::mat4 sunModel = state.sunModel;
+    // Infinite reverse-Z projection has the precision for the distant Sun,
+    // it goes through the same view & projection as the other bodies
+    glm::mat4 sunModel = model;
 
-    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, vShaderId);
-    glActiveShaderProgram(state.renderPipeline, vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_VERTEX_SHADER_BIT, shader.vShaderId);
+    glUseProgramStages(state.renderPipeline, GL_GEOMETRY_SHADER_BIT, shader.gShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.vShaderId);
     glUniformMatrix4fv(0, 1, false, glm::value_ptr(sunModel));
-    glUniformMatrix4fv(1, 1, false, glm::value_ptr(sunView));
-    glUniformMatrix4fv(2, 1, false, glm::value_ptr(sunProj));
+    glUniformMatrix4fv(1, 1, false, glm::value_ptr(view));
+    glUniformMatrix4fv(2, 1, false, glm::value_ptr(proj));
     //No need for normal since it is just white
-    glUniform1ui(4, state.mode);  
 
-    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, fShaderId);
-    glActiveShaderProgram(state.renderPipeline, fShaderId);
-    glUniform1ui(0, state.mode);
+    glUseProgramStages(state.renderPipeline, GL_FRAGMENT_SHADER_BIT, shader.fShaderId);
+    glActiveShaderProgram(state.renderPipeline, shader.fShaderId);
 
 
     glActiveTexture(GL_TEXTURE0);
@@ -366,70 +732,280 @@ void drawSun(GLState& state, const MeshGL& mesh, const TextureGL& texture, GLuin
  
 }
 
-void setupShadowMap(GLuint& fbo, GLuint& colorTex, GLuint& depthTex, int res){
-    
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    
-    glGenTextures(1, &colorTex);
-    glBindTexture(GL_TEXTURE_2D, colorTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, res, res, 0, GL_RED, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f }; 
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-   
-    glGenTextures(1, &depthTex);
-    glBindTexture(GL_TEXTURE_2D, depthTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, res, res, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// Warps the cascades in "mask" into EVSM moments & blurs them (separable),
+// "tempTex" holds the horizontally blurred layer
+void filterShadowMoments(GLState& state, const ShaderProgram& blurX, const ShaderProgram& blurY,
+                         GLuint depthTex, GLuint tempTex, const ShadowMomentsGL& moments, uint32_t mask){
+    if(!blurX.ready || !blurY.ready) return;
+
+    GLuint groups = (GLuint(moments.resolution) + ShadowMomentsGL::WORK_GROUP_SIZE - 1) / ShadowMomentsGL::WORK_GROUP_SIZE;
+    glBindSampler(ShadowMomentsGL::T_INPUT, moments.samplerId);
+    glActiveTexture(GL_TEXTURE0 + ShadowMomentsGL::T_INPUT);
+    for(uint32_t i = 0; i < ShadowCascadesGL::CASCADE_COUNT; i++){
+        if((mask & (1u << i)) == 0) continue;
+
+        // Depth layer -> moments -> horizontal blur
+        glUseProgramStages(state.renderPipeline, GL_COMPUTE_SHADER_BIT, blurX.cShaderId);
+        glProgramUniform1i(blurX.cShaderId, 0, GLint(i));
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+        glBindImageTexture(ShadowMomentsGL::I_OUTPUT, tempTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, ShadowMomentsGL::FORMAT);
+        glDispatchCompute(groups, groups, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        // Vertical blur -> moments layer
+        glUseProgramStages(state.renderPipeline, GL_COMPUTE_SHADER_BIT, blurY.cShaderId);
+        glProgramUniform1i(blurY.cShaderId, 0, GLint(i));
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glBindTexture(GL_TEXTURE_2D, tempTex);
+        glBindImageTexture(ShadowMomentsGL::I_OUTPUT, moments.textureId, 0, GL_TRUE, 0, GL_WRITE_ONLY, ShadowMomentsGL::FORMAT);
+        glDispatchCompute(groups, groups, 1);
+        // Temp is overwritten by the next layer
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glBindSampler(ShadowMomentsGL::T_INPUT, 0);
+    glBindImageTexture(ShadowMomentsGL::I_OUTPUT, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, ShadowMomentsGL::FORMAT);
 
+    // Mip chain makes the lit shader's single fetch prefiltered at any distance
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    glGenerateTextureMipmap(moments.textureId);
 }
 
 int main(int argc, const char* argv[])
 {
+    uint32_t asteroidCount = 2000; //abc Number of bodies in the asteroid belt
+    bool benchInstances = false;
+    bool benchTransforms = false;
+    std::string scenePath = "scenes/solar.scene";
+    uint32_t generatedBodies = 0;
+    std::string generatedScenePath;
+    ShadowQuality shadowQuality = ShadowQuality::MEDIUM;
+    ShadowMode shadowMode = ShadowMode::MAP;
+    uint32_t shadowInterval = 1; //abc Frames between the shadow updates of the first cascade
+    bool compressSky = true;
+    bool starCatalogSky = false;
+    float impostorRadius = 24.0f; //abc Bodies smaller than this (projected radius in pixels) are ray-cast impostors
+    bool tessellateEarth = true;
+    bool earthTerrain = true;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if(arg == "--bench-instances") benchInstances = true;
+        else if(arg == "--bench-transforms") benchTransforms = true;
+        else if(arg == "--scene" && i + 1 < argc) scenePath = argv[++i];
+        else if(arg == "--gen-scene" && i + 2 < argc){
+            generatedBodies = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+            generatedScenePath = argv[++i];
+        }
+        else if(arg == "--asteroids" && i + 1 < argc) asteroidCount = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        else if(arg == "--no-shader-cache") ShaderGL::binaryCacheDir.clear();
+        else if(arg == "--no-texture-cache") CubemapGL::cacheDir.clear();
+        else if(arg == "--no-sky-compression") compressSky = false;
+        else if(arg == "--sky" && i + 1 < argc){
+            std::string_view m = argv[++i];
+            if(m == "texture") starCatalogSky = false;
+            else if(m == "stars") starCatalogSky = true;
+            else std::fprintf(stderr, "Unknown sky mode \"%s\", ignoring.\n", argv[i]);
+        }
+        else if(arg == "--shadow-quality" && i + 1 < argc){
+            std::string_view q = argv[++i];
+            if(q == "low") shadowQuality = ShadowQuality::LOW;
+            else if(q == "medium") shadowQuality = ShadowQuality::MEDIUM;
+            else if(q == "high") shadowQuality = ShadowQuality::HIGH;
+            else std::fprintf(stderr, "Unknown shadow quality \"%s\", ignoring.\n", argv[i]);
+        }
+        else if(arg == "--shadow-mode" && i + 1 < argc){
+            std::string_view m = argv[++i];
+            if(m == "map") shadowMode = ShadowMode::MAP;
+            else if(m == "evsm") shadowMode = ShadowMode::EVSM;
+            else if(m == "analytic") shadowMode = ShadowMode::ANALYTIC;
+            else std::fprintf(stderr, "Unknown shadow mode \"%s\", ignoring.\n", argv[i]);
+        }
+        else if(arg == "--no-tessellation") tessellateEarth = false;
+        else if(arg == "--no-terrain") earthTerrain = false;
+        else if(arg == "--no-terrain-cache") TerrainGL::cacheDir.clear();
+        else if(arg == "--impostor-radius" && i + 1 < argc) impostorRadius = std::strtof(argv[++i], nullptr);
+        else if(arg == "--shadow-interval" && i + 1 < argc) shadowInterval = std::max(1u, uint32_t(std::strtoul(argv[++i], nullptr, 10)));
+        else std::fprintf(stderr, "Unknown argument \"%s\", ignoring.\n", argv[i]);
+    }
+
+    if(benchTransforms){
+        runTransformBenchmark();
+        return 0;
+    }
+
+    // Bodies & their assets
+    SceneGraph scene;
+    SceneAssets sceneAssets;
+    LoadScene(scene, sceneAssets, scenePath);
+    // Adds random bodies to the scene, saves it in the binary form
+    // (load it with "--scene") and exits
+    if(!generatedScenePath.empty()){
+        GenerateBodies(scene, sceneAssets, generatedBodies, 477u);
+        SaveSceneBinary(scene, sceneAssets, generatedScenePath);
+        std::printf("Scene of %zu bodies is written to \"%s\".\n", scene.Size(), generatedScenePath.c_str());
+        return 0;
+    }
+
     GLState state = GLState("Planet Renderer", 1280, 720, CallbackPointersGLFW());
-    ShaderGL vShader = ShaderGL(ShaderGL::VERTEX, "shaders/generic.vert");
-    ShaderGL fShader = ShaderGL(ShaderGL::FRAGMENT, "shaders/debug.frag");
+    state.shadowQuality = uint32_t(shadowQuality);
+    state.shadowMode = uint32_t(shadowMode);
+    ShaderLibrary shaders = ShaderLibrary(shadowMode, shadowQuality);
+    FileWatcher shaderWatcher = FileWatcher("shaders");
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    // Reverse-Z; [0, 1] clip depth, cleared to the (infinite) far plane at 0
+    // and nearer fragments are greater. Float depth keeps its precision
+    // across the whole range (see "PerspectiveReverseZ")
+    glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glClearDepth(0.0);
+    glDepthFunc(GL_GREATER);
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE); // Meshes are closed, back faces are never visible
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     //Objects
-    MeshGL Earth = MeshGL("meshes/sphere_20k.obj");
-    MeshGL Moon = MeshGL("meshes/sphere_5k.obj");
-    MeshGL Jupiter = MeshGL("meshes/sphere_2k.obj");
-    MeshGL Sky = MeshGL("meshes/sphere_80k.obj");   
-    MeshGL Sun = MeshGL("meshes/sphere_2k.obj");
+    const uint32_t EARTH   = scene.Get("Earth");
+    const uint32_t MOON    = scene.Get("Moon");
+    const uint32_t JUPITER = scene.Get("Jupiter");
+    const uint32_t SUN     = scene.Get("Sun");
+    std::vector<MeshGL> sceneMeshes;
+    sceneMeshes.reserve(sceneAssets.meshes.size());
+    for(const SceneAssets::Resource& mesh : sceneAssets.meshes)
+        sceneMeshes.emplace_back(mesh.path);
+    const MeshGL& Earth   = sceneMeshes[scene.meshes[EARTH]];
+    const MeshGL& Moon    = sceneMeshes[scene.meshes[MOON]];
+    const MeshGL& Jupiter = sceneMeshes[scene.meshes[JUPITER]];
+    const MeshGL& Sun     = sceneMeshes[scene.meshes[SUN]];
+
+    // Earth is the only body with night lights, clouds & oceans
+    const SceneMaterial& earthMaterial = sceneAssets.materials[scene.materials[EARTH]];
+    if(earthMaterial.night == SceneMaterial::NO_TEXTURE ||
+       earthMaterial.clouds == SceneMaterial::NO_TEXTURE ||
+       earthMaterial.specularMap == SceneMaterial::NO_TEXTURE){
+        std::fprintf(stderr, "Material of the Earth needs night, cloud & specular maps!\n");
+        std::exit(EXIT_FAILURE);
+    }
+    // Patches of the tessellated Earth (view pass only, shadows use the mesh)
+    MeshGL EarthPatches = GenerateIcosphere(2); //abc 320 patches
+    // Relief of the Earth, close to the surface in the free camera
+    // (heights are masked by the oceans of the specular map)
+    std::optional<TerrainGL> EarthTerrain;
+    if(earthTerrain){
+        uint32_t workerCount = std::clamp(std::thread::hardware_concurrency(), 2u, 5u) - 1; //abc Tile workers
+        EarthTerrain.emplace(sceneAssets.textures[earthMaterial.specularMap].path, workerCount);
+    }
 
     //Textures
-    TextureGL EarthSpecTex = TextureGL("textures/2k_earth_specular_map.png", TextureGL::LINEAR, TextureGL::REPEAT);
+    std::vector<TextureGL> sceneTextures;
+    sceneTextures.reserve(sceneAssets.textures.size());
+    for(const SceneAssets::Resource& texture : sceneAssets.textures)
+        sceneTextures.emplace_back(texture.path, TextureGL::LINEAR, TextureGL::REPEAT);
+    const TextureGL& EarthTex      = sceneTextures[earthMaterial.albedo];
+    const TextureGL& EarthNightTex = sceneTextures[earthMaterial.night];
+    const TextureGL& CloudTex      = sceneTextures[earthMaterial.clouds];
+    const TextureGL& EarthSpecTex  = sceneTextures[earthMaterial.specularMap];
+    const TextureGL& MoonTex       = sceneTextures[sceneAssets.materials[scene.materials[MOON]].albedo];
+    const TextureGL& JupiterTex    = sceneTextures[sceneAssets.materials[scene.materials[JUPITER]].albedo];
+    const TextureGL& SunTex        = sceneTextures[sceneAssets.materials[scene.materials[SUN]].albedo];
+    // Only one of the skies is loaded, star catalog mode does not decode
+    // the 8k image (except once, to generate the catalog)
+    std::optional<CubemapGL> SkyTex;
+    std::optional<StarFieldGL> Stars;
+    if(starCatalogSky){
+        StarCatalog catalog;
+        if(!LoadStarCatalog(catalog, "textures/star_catalog.bin")){
+            catalog = GenerateStarCatalog("textures/8k_stars_milky_way.jpg", 512); //abc Width of the glow
+            SaveStarCatalog(catalog, "textures/star_catalog.bin");
+        }
+        Stars.emplace(catalog);
+    }
+    else SkyTex.emplace("textures/8k_stars_milky_way.jpg", compressSky);
+
+    // Albedos of the instanced bodies, the belt's are the first layers
+    // (it picks any of them), then the ones of the other bodies
+    const std::array<uint32_t, 4> namedBodies = {EARTH, MOON, JUPITER, SUN};
+    std::vector<uint32_t> textureLayers(sceneAssets.textures.size(), UINT32_MAX);
+    std::vector<std::string> layerPaths;
+    auto AddLayer = [&](uint32_t texture){
+        if(textureLayers[texture] != UINT32_MAX) return;
+        textureLayers[texture] = uint32_t(layerPaths.size());
+        layerPaths.push_back(sceneAssets.textures[texture].path);
+    };
+    for(uint32_t material : sceneAssets.beltMaterials) AddLayer(sceneAssets.materials[material].albedo);
+    uint32_t beltLayerCount = uint32_t(layerPaths.size());
+    for(uint32_t body = 0; body < uint32_t(scene.Size()); body++)
+        if(std::find(namedBodies.begin(), namedBodies.end(), body) == namedBodies.end())
+            AddLayer(sceneAssets.materials[scene.materials[body]].albedo);
+    // Never empty (instanced benchmark)
+    if(layerPaths.empty()) AddLayer(sceneAssets.materials[scene.materials[MOON]].albedo);
+    TextureArrayGL BodyTexArray = TextureArrayGL(layerPaths, 1024, 512, TextureGL::REPEAT);
+
+    if(benchInstances){
+        // Timings must not include the compilation
+        shaders.WaitAll();
+        runInstanceBenchmark(state, Jupiter, Moon, BodyTexArray, shaders[ShaderVariant::INSTANCED]);
+        return 0;
+    }
 
-    TextureGL EarthNightTex = TextureGL("textures/2k_earth_nightmap_alpha.png", TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL CloudTex      = TextureGL("textures/2k_earth_clouds_alpha.png",   TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL EarthTex = TextureGL("textures/2k_earth_daymap.jpg", TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL MoonTex = TextureGL("textures/2k_moon.jpg", TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL JupiterTex = TextureGL("textures/2k_jupiter.jpg", TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL SkyTex = TextureGL("textures/8k_stars_milky_way.jpg", TextureGL::LINEAR, TextureGL::REPEAT);
-    TextureGL SunTex = TextureGL("textures/2k_moon.jpg", TextureGL::LINEAR, TextureGL::REPEAT); //random as sun tex is not provided and it would be white anyway
+    // Asteroid belt (none if the scene has no belt materials)
+    if(beltLayerCount == 0) asteroidCount = 0;
+    std::vector<SmallBody> beltBodies;
+    std::vector<BodyInstance> beltInstances;
+    GenerateAsteroidBelt(beltBodies, asteroidCount, sceneAssets.beltInner, sceneAssets.beltOuter, beltLayerCount, 477u);
+    InstancedBodiesGL Belt = InstancedBodiesGL(asteroidCount);
+
+    // Rest of the bodies, a single instanced draw per mesh
+    std::vector<SceneInstances> sceneInstances;
+    for(uint32_t mesh = 0; mesh < uint32_t(sceneMeshes.size()); mesh++){
+        std::vector<uint32_t> bodies;
+        for(uint32_t body = 0; body < uint32_t(scene.Size()); body++)
+            if(scene.meshes[body] == mesh && std::find(namedBodies.begin(), namedBodies.end(), body) == namedBodies.end())
+                bodies.push_back(body);
+        if(bodies.empty()) continue;
+        uint32_t count = uint32_t(bodies.size());
+        sceneInstances.push_back(SceneInstances{mesh, std::move(bodies), std::vector<BodyInstance>(count), InstancedBodiesGL(count)});
+    }
 
     //Starting setup
 
-    state.earthModel = glm::scale(state.earthModel, glm::vec3(3.0f)); //abc This is the scale for the Earth
+    // Bodies the camera modes orbit around (free camera is the last mode)
+    const std::array<uint32_t, 3> cameraTargets = {EARTH, MOON, JUPITER};
 
-    float CurrentSimTime = 0.0f;   
-    float lastFrameTime = 0.0f;    
+    double CurrentSimTime = 0.0;   
+    double lastFrameTime = 0.0;    
     
-    GLuint shadowFBO, shadowColorTex, shadowDepthTex;
-    const int SHADOW_RES = 2048; 
-    setupShadowMap(shadowFBO, shadowColorTex, shadowDepthTex, SHADOW_RES);
+    const int SHADOW_RES = 2048; //abc Per cascade
+    const float SHADOW_DISTANCE = 150.0f; //abc Farthest shadowed distance from the camera
+    const float SHADOW_CASTER_EXTENT = 60.0f; //abc Casters this far behind a cascade (towards the sun) are included
+    // Depth only, one layer per cascade, sampled directly by the lit
+    // variants (sampler2DArrayShadow). Owned by the cascades since the
+    // layers are cached across frames, imported to the graph every frame
+    const FGTextureDesc shadowDepthDesc = {.width = SHADOW_RES, .height = SHADOW_RES,
+                                           .layers = int32_t(ShadowCascadesGL::CASCADE_COUNT),
+                                           .format = GL_DEPTH_COMPONENT24,
+                                           .filter = GL_LINEAR, .wrap = GL_CLAMP_TO_BORDER,
+                                           .compare = GL_COMPARE_REF_TO_TEXTURE};
+    ShadowCascadesGL shadowCascades = ShadowCascadesGL(SHADOW_RES);
+    // Filtered at half resolution, blur is in moment texels
+    const FGTextureDesc momentsTempDesc = {.width = SHADOW_RES / 2, .height = SHADOW_RES / 2,
+                                           .format = ShadowMomentsGL::FORMAT};
+    ShadowMomentsGL shadowMoments = ShadowMomentsGL(SHADOW_RES / 2);
+    const FGTextureDesc momentsDesc = {.width = shadowMoments.resolution, .height = shadowMoments.resolution,
+                                       .layers = int32_t(ShadowCascadesGL::CASCADE_COUNT),
+                                       .levels = shadowMoments.levels,
+                                       .format = ShadowMomentsGL::FORMAT,
+                                       .filter = GL_LINEAR_MIPMAP_LINEAR};
+    shadowCascades.updateInterval = shadowInterval;
+    uint64_t frameCount = 0;
+    SphereOccludersGL occluders;
+
+    FrameGraph frameGraph;
+    CullStats cullStats;
+    OcclusionQueriesGL occlusionQueries;
+    // Bodies that are tested against Earth's depth
+    constexpr uint32_t QUERY_MOON       = 0;
+    constexpr uint32_t QUERY_JUPITER    = 1;
 
     // =============== //
     //   RENDER LOOP   //
@@ -438,23 +1014,37 @@ int main(int argc, const char* argv[])
     while(!glfwWindowShouldClose(state.window)){
     
         glfwPollEvents();
+        // Minimized, there is nothing to render into (the transients would
+        // be empty & the aspect infinite). Simulation is paused meanwhile
+        if(state.width == 0 || state.height == 0){
+            glfwWaitEvents();
+            lastFrameTime = glfwGetTime();
+            continue;
+        }
+        // Picks up the variants that finished compiling since the last frame,
+        // draws of the pending ones are skipped. Edited shader files are
+        // recompiled in the background and swapped here as well.
+        shaders.Reload(shaderWatcher.Poll());
+        shaders.SetShadowMode(ShadowMode(state.shadowMode));
+        shaders.SetShadowQuality(ShadowQuality(state.shadowQuality));
+        shaders.Poll();
 
         // Time management
-        float currentTime = static_cast<float>(glfwGetTime());
-        float deltaTime = currentTime - lastFrameTime;
+        double currentTime = glfwGetTime();
+        double deltaTime = currentTime - lastFrameTime;
         lastFrameTime = currentTime;
-        CurrentSimTime += deltaTime * state.SimSpeed;
+        CurrentSimTime += deltaTime * double(state.SimSpeed);
 
         // Calculate and save the positions  
-        
-        //abc                               Planet OrbitSize    OrbitSpeed   Scale
-        assignMoonMatrix(state, CurrentSimTime, 0, 12.0f,       0.8f,        1.0f); // Moon
-        assignMoonMatrix(state, CurrentSimTime, 1, 3.0f,        1.5,        0.33f);  // Jupiter // Look for the function for the value of Scale
-        assignMoonMatrix(state, CurrentSimTime, 2, 300.0f,      0.005f,      2.0f); // Sun
+        scene.Update(CurrentSimTime);
+        state.lightDir = glm::vec3(glm::normalize(scene.Position(SUN) - scene.Position(EARTH)));
+
+        AnimateBodies(beltInstances, beltBodies, CurrentSimTime);
+        Belt.Upload(beltInstances);
 
         // Cam matrices
 
-        glm::mat4 proj = glm::perspective(glm::radians(state.FOV), (float)state.width / state.height, 0.1f, 1000.0f);
+        glm::mat4 proj = PerspectiveReverseZ(glm::radians(state.FOV), (float)state.width / state.height, 0.1f);
 
         //dir = Planet - Camera
         glm::vec3 dir; 
@@ -463,22 +1053,15 @@ int main(int argc, const char* argv[])
         dir.z = sin(glm::radians(state.yaw)) * cos(glm::radians(state.pitch));
         dir = glm::normalize(dir);
 
+        // Camera is at the origin of the render space (floating origin),
+        // its world position is kept in "state.pos"
         glm::mat4 view;
+        glm::dvec3 orbitOffset = glm::dvec3(dir) * double(state.cameraDistance);
 
-        if (state.cameraMode == 0){ // Earth 
-            state.pos = state.earthVec + dir * state.cameraDistance; 
-            view = glm::lookAt(state.pos, state.earthVec, state.up);
+        if (state.cameraMode < cameraTargets.size()){ // Earth, Moon & Jupiter
+            state.pos = scene.Position(cameraTargets[state.cameraMode]) + orbitOffset; 
+            view = glm::lookAt(glm::vec3(0.0f), -dir, state.up);
         } 
-        else if (state.cameraMode == 1){ // Moon 
-            state.pos = state.moonVec + dir * state.cameraDistance;
-            view = glm::lookAt(state.pos, state.moonVec, state.up);
-        }
-        else if (state.cameraMode == 2){ // Jupiter 
-            state.pos = state.jupiterVec + dir * state.cameraDistance;
-            view = glm::lookAt(state.pos, state.jupiterVec, state.up);
-        }
-        
-    
         else if (state.cameraMode == 3){ 
             
             glm::vec3 front;
@@ -489,64 +1072,251 @@ int main(int argc, const char* argv[])
             
             glm::vec3 right = glm::normalize(glm::cross(forward, state.up));
 
-            float cameraSpeed = 15.0f * deltaTime; 
+            double cameraSpeed = 15.0 * deltaTime; 
 
-            if (glfwGetKey(state.window, GLFW_KEY_W) == GLFW_PRESS) state.pos += forward * cameraSpeed;
-            if (glfwGetKey(state.window, GLFW_KEY_S) == GLFW_PRESS) state.pos -= forward * cameraSpeed;
-            if (glfwGetKey(state.window, GLFW_KEY_A) == GLFW_PRESS) state.pos -= right * cameraSpeed;
-            if (glfwGetKey(state.window, GLFW_KEY_D) == GLFW_PRESS) state.pos += right * cameraSpeed;
+            if (glfwGetKey(state.window, GLFW_KEY_W) == GLFW_PRESS) state.pos += glm::dvec3(forward) * cameraSpeed;
+            if (glfwGetKey(state.window, GLFW_KEY_S) == GLFW_PRESS) state.pos -= glm::dvec3(forward) * cameraSpeed;
+            if (glfwGetKey(state.window, GLFW_KEY_A) == GLFW_PRESS) state.pos -= glm::dvec3(right) * cameraSpeed;
+            if (glfwGetKey(state.window, GLFW_KEY_D) == GLFW_PRESS) state.pos += glm::dvec3(right) * cameraSpeed;
 
-            view = glm::lookAt(state.pos, state.pos + forward, state.up);
+            view = glm::lookAt(glm::vec3(0.0f), forward, state.up);
         }
-        // Shadow matrix
-        
-        glm::mat4 lightView = glm::lookAt(state.sunVec,glm::vec3(0,0,0) , glm::vec3(0, 1, 0));
-        glm::mat4 lightProj = glm::ortho(-30.0f, 30.0f, -30.0f, 30.0f, 0.1f, 1000.0f);
-        state.lightSpaceMatrix = lightProj * lightView;
 
-        // Shadow mapping 
-        state.mode = 3; // In this mode we are saving only z-depths
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO); // <- Warning from here program/shader state performance warning: Vertex shader in program 2 is being recompiled based on GL state.
-                                                      // Couldnt find a solution :(
-        glViewport(0, 0, SHADOW_RES, SHADOW_RES);
-        
-        float largeVal[] ={ 1.0f, 0.0f, 0.0f, 0.0f };   
-        glClearBufferfv(GL_COLOR, 0, largeVal);
-        glClear(GL_DEPTH_BUFFER_BIT);
+        // Camera-relative copies of the world state, only these reach the GPU
+        const glm::dvec3 origin = state.pos;
+        glm::mat4 earthModel   = CameraRelative(scene.world[EARTH], origin);
+        glm::mat4 moonModel    = CameraRelative(scene.world[MOON], origin);
+        glm::mat4 jupiterModel = CameraRelative(scene.world[JUPITER], origin);
+        glm::mat4 sunModel     = CameraRelative(scene.world[SUN], origin);
+        glm::mat4 beltModel    = CameraRelative(glm::translate(glm::dmat4(1.0), scene.Position(EARTH)), origin); // Belt is around the Earth
+        for(SceneInstances& group : sceneInstances)
+            animateSceneInstances(group, scene, sceneAssets, textureLayers, origin, CurrentSimTime);
+        // Occluder spheres for the analytic shadows
+        occluders.Clear();
+        occluders.AddOccluder(earthModel);
+        occluders.AddOccluder(moonModel);
+        occluders.AddOccluder(jupiterModel);
+        occluders.SetSun(sunModel);
+        occluders.Upload();
+        occluders.Bind();
+
+        // Shadow map is still needed while the shadowed variants are
+        // being recompiled after a mode change (they keep the old programs)
+        bool useShadowMap = (shaders.shadowMode != ShadowMode::ANALYTIC || shaders.issuing);
+        bool useMoments = (shaders.shadowMode == ShadowMode::EVSM || shaders.issuing);
+        // Only the dirty cascades are re-rendered, the rest are reused
+        // from the previous frames
+        uint32_t cascadeMask = 0;
+        if(useShadowMap){
+            // Spin of the bodies does not change their shadows
+            std::vector<glm::vec4> casters = {SphereFromModel(earthModel),
+                                              SphereFromModel(moonModel),
+                                              SphereFromModel(jupiterModel)};
+            // Shadow cascades, fitted to the camera frustum
+            // (sun is far away, treat it as a directional light)
+            cascadeMask = shadowCascades.Update(CascadeParams
+            {
+                .view           = view,
+                .origin         = origin,
+                .fovY           = glm::radians(state.FOV),
+                .aspect         = float(state.width) / float(state.height),
+                .zNear          = 0.1f,
+                .shadowDistance = SHADOW_DISTANCE,
+                .lightDir       = state.lightDir,
+                .casterExtent   = SHADOW_CASTER_EXTENT
+            }, casters);
+            shadowCascades.Bind();
+        }
+        if(!useShadowMap || !shaders[ShaderVariant::SHADOW_DEPTH].ready){
+            // Nothing is rendered (or the map is unused), cached layers
+            // would be stale when the map is needed again
+            shadowCascades.Invalidate();
+        }
+        // Only the re-rendered (or not yet filtered) cascades are filtered
+        uint32_t momentsMask = 0;
+        if(useMoments) momentsMask = shadowMoments.Update(cascadeMask);
+        if(!useMoments || !shaders[ShaderVariant::EVSM_BLUR_X].ready ||
+           !shaders[ShaderVariant::EVSM_BLUR_Y].ready)
+            shadowMoments.Invalidate();
+
+        // Culling, bodies are tested with their (spin invariant) bounding
+        // spheres against the camera & the re-rendered cascades
+        glm::mat4 cloudModel = glm::scale(earthModel, glm::vec3(1.02f)); // Must match "drawClouds"
+        glm::vec4 earthSphere   = TransformSphere(Earth.boundingSphere, earthModel);
+        glm::vec4 cloudSphere   = TransformSphere(Earth.boundingSphere, cloudModel);
+        glm::vec4 moonSphere    = TransformSphere(Moon.boundingSphere, moonModel);
+        glm::vec4 jupiterSphere = TransformSphere(Jupiter.boundingSphere, jupiterModel);
+        glm::vec4 sunSphere     = TransformSphere(Sun.boundingSphere, sunModel);
+
+        std::array<Frustum, 1> viewFrustum = {Frustum::FromMatrix(proj * view)};
+        std::array<Frustum, ShadowCascadesGL::CASCADE_COUNT> cascadeFrusta;
+        size_t cascadeFrustumCount = 0;
+        for(uint32_t i = 0; i < ShadowCascadesGL::CASCADE_COUNT; i++){
+            if((cascadeMask & (1u << i)) == 0) continue;
+            cascadeFrusta[cascadeFrustumCount++] = Frustum::FromMatrix(shadowCascades.data.lightViewProj[i]);
+        }
+        std::span<const Frustum> shadowFrusta = std::span(cascadeFrusta).first(cascadeFrustumCount);
+
+        cullStats.Reset();
+        occlusionQueries.Resolve(cullStats.occlusion);
+        // Belt is a single instanced draw (not culled)
+        bool sunVisible     = cullStats.view.Test(sunSphere, viewFrustum);
+        bool earthVisible   = cullStats.view.Test(earthSphere, viewFrustum);
+        bool cloudVisible   = cullStats.view.Test(cloudSphere, viewFrustum);
+        bool moonVisible    = cullStats.view.Test(moonSphere, viewFrustum);
+        bool jupiterVisible = cullStats.view.Test(jupiterSphere, viewFrustum);
+        bool earthCasts     = (cascadeMask != 0) && cullStats.shadow.Test(earthSphere, shadowFrusta);
+        bool moonCasts      = (cascadeMask != 0) && cullStats.shadow.Test(moonSphere, shadowFrusta);
+        bool jupiterCasts   = (cascadeMask != 0) && cullStats.shadow.Test(jupiterSphere, shadowFrusta);
+
+        // Distant bodies switch to the impostors (shadow pass still uses the meshes)
+        glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+        float viewportHeight = float(state.height);
+        bool sunImpostor     = ProjectedRadius(sunSphere, cameraPos, glm::radians(state.FOV), viewportHeight) < impostorRadius;
+        bool moonImpostor    = ProjectedRadius(moonSphere, cameraPos, glm::radians(state.FOV), viewportHeight) < impostorRadius;
+        bool jupiterImpostor = ProjectedRadius(jupiterSphere, cameraPos, glm::radians(state.FOV), viewportHeight) < impostorRadius;
+
+        // Terrain replaces the Earth close to its surface in the free camera
+        // (shadow pass & the clouds still use the mesh)
+        const float TERRAIN_DISTANCE = 2.0f; //abc Earth radii from the center
+        glm::mat4 earthSpun = spinModel(earthModel, CurrentSimTime, scene.spinSpeed[EARTH]);
+        glm::vec3 cameraEarth = glm::vec3(glm::inverse(earthSpun) * glm::vec4(cameraPos, 1.0f));
+        bool terrainVisible = earthVisible && EarthTerrain && state.cameraMode == 3 &&
+                              glm::length(cameraEarth) < TERRAIN_DISTANCE;
+        if(terrainVisible){
+            EarthTerrain->Update(cameraEarth, earthSpun, viewFrustum[0]);
+            EarthTerrain->PrintSummaryIfChanged();
+        }
 
-        drawEarth(state, Earth, EarthTex,EarthNightTex,EarthSpecTex, vShader.shaderId, fShader.shaderId, state.earthModel, lightView, lightProj, CurrentSimTime,shadowColorTex);
-        drawMoon(state, Moon, MoonTex, vShader.shaderId, fShader.shaderId, state.moonModel, lightView, lightProj, CurrentSimTime);
-        drawMoon(state, Jupiter, JupiterTex, vShader.shaderId, fShader.shaderId, state.jupiterModel, lightView, lightProj, CurrentSimTime);
-        
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);           
-        glViewport(0, 0, state.width, state.height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Frame graph, passes only declare what they read & write
+        // order, culling and render targets are handled by the graph
+        frameGraph.Reset();
+        FGHandle backbuffer = frameGraph.ImportBackbuffer("Backbuffer", state.width, state.height);
+        FGHandle shadowMap = frameGraph.Import("ShadowMap", shadowCascades.textureId, shadowDepthDesc);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, shadowColorTex);
+        // Shadow mapping 
+        if(cascadeMask != 0) frameGraph.AddPass("ShadowMap",
+        [&](FGBuilder& b){
+            // No color attachment (draw buffers are GL_NONE)
+            shadowMap = b.WriteDepth(shadowMap);
+        },
+        [&](const FrameGraph&){
+            // Only the dirty layers are cleared, the others are cached
+            shadowCascades.ClearLayers(cascadeMask);
+
+            // Depth only variant without a fragment stage,
+            // dirty cascades are rendered at once (view & projection are unused)
+            const ShaderProgram& depthShader = shaders[ShaderVariant::SHADOW_DEPTH];
+            glProgramUniform1ui(depthShader.gShaderId, 0, cascadeMask);
+            glm::mat4 unused = glm::mat4(1.0f);
+            // Shadow maps are not reversed (cleared to 1, see "ShadowCascadesGL::Update")
+            glDepthFunc(GL_LESS);
+            if(earthCasts) drawEarth(state, Earth, EarthTex,EarthNightTex,EarthSpecTex, depthShader, earthModel, unused, unused, CurrentSimTime, scene.spinSpeed[EARTH], 0);
+            if(moonCasts) drawMoon(state, Moon, MoonTex, depthShader, moonModel, unused, unused, CurrentSimTime, scene.spinSpeed[MOON]);
+            if(jupiterCasts) drawMoon(state, Jupiter, JupiterTex, depthShader, jupiterModel, unused, unused, CurrentSimTime, scene.spinSpeed[JUPITER]);
+            glDepthFunc(GL_GREATER);
+        });
+
+        // Shadow prefiltering (EVSM)
+        FGHandle momentsTemp = FG_INVALID;
+        FGHandle momentsMap = frameGraph.Import("ShadowMoments", shadowMoments.textureId, momentsDesc);
+        if(momentsMask != 0) frameGraph.AddPass("ShadowFilter",
+        [&](FGBuilder& b){
+            b.Read(shadowMap);
+            momentsTemp = b.Write(b.Create("MomentsTemp", momentsTempDesc));
+            momentsMap = b.Write(momentsMap);
+        },
+        [&](const FrameGraph& fg){
+            filterShadowMoments(state, shaders[ShaderVariant::EVSM_BLUR_X], shaders[ShaderVariant::EVSM_BLUR_Y],
+                                fg.Texture(shadowMap), fg.Texture(momentsTemp), shadowMoments, momentsMask);
+        });
 
         // Rendering 
-
-        state.mode = 1; drawBackground(state, Sky, SkyTex, vShader.shaderId, fShader.shaderId, view, proj);
-        state.mode = 0; drawSun(state, Sun, SunTex, vShader.shaderId, fShader.shaderId, view, proj, CurrentSimTime);
-
-        state.mode = 2;
-        
-        drawEarth(state, Earth, EarthTex,EarthNightTex, EarthSpecTex,vShader.shaderId, fShader.shaderId, state.earthModel, view, proj, CurrentSimTime,shadowColorTex);
-        drawClouds(state, Earth, CloudTex,
-                   vShader.shaderId, fShader.shaderId,
-                   state.earthModel,
-                   view, proj,
-                   CurrentSimTime);
-        state.mode = 5;
-        drawMoon(state, Moon, MoonTex, vShader.shaderId, fShader.shaderId, state.moonModel, view, proj, CurrentSimTime);
-        drawMoon(state, Jupiter, JupiterTex, vShader.shaderId, fShader.shaderId, state.jupiterModel, view, proj, CurrentSimTime);
-        state.mode = 2;
+        // Offscreen, the window's depth buffer is fixed point
+        FGHandle sceneColor = FG_INVALID;
+        frameGraph.AddPass("Scene",
+        [&](FGBuilder& b){
+            // Unread shadow pass is culled by the graph (analytic shadows)
+            if(useShadowMap) b.Read(shadowMap);
+            if(useMoments) b.Read(momentsMap);
+            sceneColor = b.WriteColor(b.Create("SceneColor", {.width = state.width, .height = state.height}));
+            b.WriteDepth(b.Create("SceneDepth", {.width = state.width, .height = state.height,
+                                                 .format = GL_DEPTH_COMPONENT32F}));
+        },
+        [&](const FrameGraph& fg){
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            GLuint shadowTex = useShadowMap ? fg.Texture(shadowMap) : 0;
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadowTex);
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, useMoments ? fg.Texture(momentsMap) : 0);
+
+            if(sunVisible && sunImpostor) drawImpostor(state, SunTex, shaders[ShaderVariant::IMPOSTOR_EMISSIVE], sunSphere, sunModel, view, proj);
+            else if(sunVisible) drawSun(state, Sun, SunTex, shaders[ShaderVariant::EMISSIVE], sunModel, view, proj);
+
+            if(terrainVisible) drawTerrain(state, *EarthTerrain, EarthTex, EarthNightTex, EarthSpecTex, shaders[ShaderVariant::TERRAIN_EARTH], earthSpun, view, proj, shadowTex);
+            else if(earthVisible && tessellateEarth) drawEarth(state, EarthPatches, EarthTex,EarthNightTex, EarthSpecTex, shaders[ShaderVariant::LIT_EARTH_TESSELLATED], earthModel, view, proj, CurrentSimTime, scene.spinSpeed[EARTH], shadowTex);
+            else if(earthVisible) drawEarth(state, Earth, EarthTex,EarthNightTex, EarthSpecTex, shaders[ShaderVariant::LIT_EARTH], earthModel, view, proj, CurrentSimTime, scene.spinSpeed[EARTH], shadowTex);
+            // Earth is in the depth buffer, bodies hidden by
+            // them are skipped by the GPU without waiting for the results
+            const ShaderProgram& proxyShader = shaders[ShaderVariant::OCCLUSION_PROXY];
+            if(moonVisible) drawOcclusionProxy(state, occlusionQueries, proxyShader, QUERY_MOON, moonSphere, view, proj);
+            if(jupiterVisible) drawOcclusionProxy(state, occlusionQueries, proxyShader, QUERY_JUPITER, jupiterSphere, view, proj);
+
+            occlusionQueries.BeginConditional(QUERY_MOON);
+            if(moonVisible && moonImpostor) drawImpostor(state, MoonTex, shaders[ShaderVariant::IMPOSTOR_ROCKY], moonSphere, spinModel(moonModel, CurrentSimTime, scene.spinSpeed[MOON]), view, proj);
+            else if(moonVisible) drawMoon(state, Moon, MoonTex, shaders[ShaderVariant::LIT_ROCKY], moonModel, view, proj, CurrentSimTime, scene.spinSpeed[MOON]);
+            occlusionQueries.EndConditional(QUERY_MOON);
+            occlusionQueries.BeginConditional(QUERY_JUPITER);
+            if(jupiterVisible && jupiterImpostor) drawImpostor(state, JupiterTex, shaders[ShaderVariant::IMPOSTOR_ROCKY], jupiterSphere, spinModel(jupiterModel, CurrentSimTime, scene.spinSpeed[JUPITER]), view, proj);
+            else if(jupiterVisible) drawMoon(state, Jupiter, JupiterTex, shaders[ShaderVariant::LIT_ROCKY], jupiterModel, view, proj, CurrentSimTime, scene.spinSpeed[JUPITER]);
+            occlusionQueries.EndConditional(QUERY_JUPITER);
+            drawInstancedBodies(state, Belt, Jupiter, BodyTexArray, shaders[ShaderVariant::INSTANCED], beltModel, view, proj);
+            for(const SceneInstances& group : sceneInstances)
+                drawInstancedBodies(state, group.buffer, sceneMeshes[group.mesh], BodyTexArray, shaders[ShaderVariant::INSTANCED], glm::mat4(1.0f), view, proj);
+
+            // Only the pixels that are not covered by the opaque bodies
+            drawBackground(state, Stars ? Stars->glow : *SkyTex, shaders[ShaderVariant::SKY], view, proj);
+            if(Stars) drawStars(state, *Stars, shaders[ShaderVariant::STARS], view, proj);
+
+            // Blended clouds go after the opaque bodies (they may be hidden by them)
+            if(cloudVisible) drawClouds(state, Earth, CloudTex,
+                                        shaders[ShaderVariant::CLOUDS],
+                                        earthModel,
+                                        view, proj,
+                                        CurrentSimTime);
+        });
+
+        frameGraph.AddPass("Present",
+        [&](FGBuilder& b){
+            b.Read(sceneColor);
+            b.WriteColor(backbuffer);
+        },
+        [&](const FrameGraph& fg){
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, state.presentFbo);
+            glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, fg.Texture(sceneColor), 0);
+            glBlitFramebuffer(0, 0, state.width, state.height,
+                              0, 0, state.width, state.height,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        });
+
+        frameGraph.Compile();
+        frameGraph.Execute();
+        frameGraph.PrintSummaryIfChanged();
+        cullStats.PrintSummaryIfChanged();
         
         glfwSwapBuffers(state.window);
+        frameCount++;
     
     }
 
+    std::printf("Shadow cascade updates:");
+    for(const ShadowCascadesGL::Cascade& c : shadowCascades.cascades)
+        std::printf(" %llu", static_cast<unsigned long long>(c.renderCount));
+    std::printf(" / %llu frames\n", static_cast<unsigned long long>(frameCount));
+
 }
 
 
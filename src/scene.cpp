@@ -0,0 +1,557 @@
+#include "scene.h"
+
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+
+namespace
+{
+
+struct SceneFileHeader
+{
+    static constexpr uint32_t MAGIC = 0x4E435342; // "BSCN"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    textureCount;
+    uint32_t    meshCount;
+    uint32_t    materialCount;
+    uint32_t    beltMaterialCount;
+    uint32_t    bodyCount;
+    uint32_t    nameBytes;
+    float       beltInner;
+    float       beltOuter;
+};
+
+// Names are looked up while the bodies are added (parents), open
+// addressing keeps it to a single allocation for any number of bodies
+struct NameTable
+{
+    const SceneGraph&       scene;
+    std::vector<uint32_t>   slots;  // Bodies, "NO_PARENT" is an empty slot
+
+    NameTable(const SceneGraph& graph, size_t count)
+        : scene(graph)
+        , slots(std::bit_ceil(count * 2 + 1), SceneGraph::NO_PARENT)
+    {}
+
+    size_t Slot(std::string_view name) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = std::hash<std::string_view>()(name) & mask;
+        while(slots[i] != SceneGraph::NO_PARENT && scene.Name(slots[i]) != name)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    uint32_t Find(std::string_view name) const
+    {
+        return slots[Slot(name)];
+    }
+
+    // False if the name is already in the table
+    bool Insert(uint32_t body)
+    {
+        size_t i = Slot(scene.Name(body));
+        if(slots[i] != SceneGraph::NO_PARENT) return false;
+        slots[i] = body;
+        return true;
+    }
+};
+
+// Whitespace separated tokens of the text form, line by line
+struct TextParser
+{
+    const std::string&  path;
+    std::string_view    text;
+    std::string_view    line        = {};
+    int                 lineNumber  = 0;
+
+    // False at the end of the file, comments & empty lines are skipped
+    bool NextLine()
+    {
+        while(!text.empty())
+        {
+            size_t end = text.find('\n');
+            line = text.substr(0, end);
+            text = (end == std::string_view::npos) ? std::string_view() : text.substr(end + 1);
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            if(line.find_first_not_of(" \t\r") != std::string_view::npos) return true;
+        }
+        return false;
+    }
+
+    [[noreturn]] void Fail(const char* message, std::string_view token = {}) const
+    {
+        if(token.empty())
+            std::fprintf(stderr, "Scene \"%s\" line %d: %s!\n", path.c_str(), lineNumber, message);
+        else
+            std::fprintf(stderr, "Scene \"%s\" line %d: %s \"%.*s\"!\n",
+                         path.c_str(), lineNumber, message, int(token.size()), token.data());
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Empty at the end of the line
+    std::string_view Next()
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == std::string_view::npos) return {};
+        line = line.substr(start);
+        size_t end = std::min(line.find_first_of(" \t\r"), line.size());
+        std::string_view token = line.substr(0, end);
+        line = line.substr(end);
+        return token;
+    }
+
+    std::string_view Word()
+    {
+        std::string_view token = Next();
+        if(token.empty()) Fail("Missing field");
+        return token;
+    }
+
+    template<class T>
+    T Number()
+    {
+        std::string_view token = Word();
+        T value = {};
+        auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+        if(error != std::errc() || end != token.data() + token.size())
+            Fail("Not a number", token);
+        return value;
+    }
+
+    void End()
+    {
+        std::string_view token = Next();
+        if(!token.empty()) Fail("Unexpected field", token);
+    }
+
+    // Index of the named entry, "-" is "none" if allowed
+    template<class T, class Getter>
+    uint32_t Index(const std::vector<T>& entries, Getter name, bool allowNone)
+    {
+        std::string_view token = Word();
+        if(allowNone && token == "-") return UINT32_MAX;
+        for(size_t i = 0; i < entries.size(); i++)
+            if(name(entries[i]) == token) return uint32_t(i);
+        Fail("Unknown name", token);
+    }
+};
+
+void LoadSceneText(SceneGraph& scene, SceneAssets& assets, const std::string& path, std::string_view text)
+{
+    auto ResourceName = [](const SceneAssets::Resource& r) -> std::string_view { return r.name; };
+    auto MaterialName = [](const std::string& name) -> std::string_view { return name; };
+
+    // Bodies are counted first, the graph is reserved for all of them
+    TextParser counter = {.path = path, .text = text};
+    size_t bodyCount = 0;
+    while(counter.NextLine())
+        if(counter.Next() == "body") bodyCount++;
+    scene.Reserve(bodyCount, text.size());
+    NameTable names = NameTable(scene, bodyCount);
+
+    TextParser parser = {.path = path, .text = text};
+    while(parser.NextLine())
+    {
+        std::string_view kind = parser.Word();
+        if(kind == "texture" || kind == "mesh")
+        {
+            auto& list = (kind == "texture") ? assets.textures : assets.meshes;
+            std::string_view name = parser.Word();
+            std::string_view file = parser.Word();
+            list.push_back({std::string(name), std::string(file)});
+        }
+        else if(kind == "material")
+        {
+            assets.materialNames.emplace_back(parser.Word());
+            SceneMaterial m;
+            m.albedo      = parser.Index(assets.textures, ResourceName, false);
+            m.night       = parser.Index(assets.textures, ResourceName, true);
+            m.clouds      = parser.Index(assets.textures, ResourceName, true);
+            m.specularMap = parser.Index(assets.textures, ResourceName, true);
+            m.ambient     = parser.Number<float>();
+            m.specular    = parser.Number<float>();
+            m.shininess   = parser.Number<float>();
+            assets.materials.push_back(m);
+        }
+        else if(kind == "body")
+        {
+            std::string_view name = parser.Word();
+            std::string_view parentName = parser.Word();
+            uint32_t parent = SceneGraph::NO_PARENT;
+            if(parentName != "-")
+            {
+                parent = names.Find(parentName);
+                if(parent == SceneGraph::NO_PARENT) parser.Fail("Unknown parent", parentName);
+            }
+            uint32_t mesh     = parser.Index(assets.meshes, ResourceName, false);
+            uint32_t material = parser.Index(assets.materialNames, MaterialName, false);
+
+            BodyOrbit orbit;
+            orbit.orbitRadius    = parser.Number<double>();
+            orbit.orbitSpeed     = parser.Number<double>();
+            orbit.orbitPhase     = parser.Number<double>();
+            orbit.scale          = parser.Number<double>();
+            orbit.spinSpeed      = parser.Number<double>();
+            orbit.oscAmplitude.x = parser.Number<double>();
+            orbit.oscAmplitude.y = parser.Number<double>();
+            orbit.oscFrequency.x = parser.Number<double>();
+            orbit.oscFrequency.y = parser.Number<double>();
+            orbit.oscPhase.x     = parser.Number<double>();
+            orbit.oscPhase.y     = parser.Number<double>();
+
+            uint32_t body = scene.Add(name, parent, orbit, mesh, material);
+            if(!names.Insert(body)) parser.Fail("Duplicate body", name);
+        }
+        else if(kind == "belt")
+        {
+            assets.beltInner = parser.Number<float>();
+            assets.beltOuter = parser.Number<float>();
+            assets.beltMaterials.clear();
+            assets.beltMaterials.push_back(parser.Index(assets.materialNames, MaterialName, false));
+            while(!parser.line.empty() && parser.line.find_first_not_of(" \t\r") != std::string_view::npos)
+                assets.beltMaterials.push_back(parser.Index(assets.materialNames, MaterialName, false));
+        }
+        else parser.Fail("Unknown entry", kind);
+        parser.End();
+    }
+}
+
+// Binary form
+template<class T>
+void WriteArray(std::ofstream& file, const std::vector<T>& values)
+{
+    file.write(reinterpret_cast<const char*>(values.data()), std::streamsize(values.size() * sizeof(T)));
+}
+
+template<class T>
+void ReadArray(std::ifstream& file, std::vector<T>& values, size_t count)
+{
+    values.resize(count);
+    file.read(reinterpret_cast<char*>(values.data()), std::streamsize(count * sizeof(T)));
+}
+
+void WriteString(std::ofstream& file, const std::string& s)
+{
+    uint32_t length = uint32_t(s.size());
+    file.write(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
+    file.write(s.data(), std::streamsize(length));
+}
+
+bool ReadString(std::ifstream& file, std::string& s)
+{
+    static constexpr uint32_t MaxLength = 4096;
+    uint32_t length = 0;
+    file.read(reinterpret_cast<char*>(&length), sizeof(uint32_t));
+    if(!file || length > MaxLength) return false;
+    s.resize(length);
+    file.read(s.data(), std::streamsize(length));
+    return bool(file);
+}
+
+// Indices of the binary form are not checked while reading
+bool IsValid(const SceneGraph& scene, const SceneAssets& assets)
+{
+    auto ValidTexture = [&](uint32_t t){ return t == SceneMaterial::NO_TEXTURE || t < assets.textures.size(); };
+    for(const SceneMaterial& m : assets.materials)
+        if(m.albedo >= assets.textures.size() || !ValidTexture(m.night) ||
+           !ValidTexture(m.clouds) || !ValidTexture(m.specularMap))
+            return false;
+    for(uint32_t m : assets.beltMaterials)
+        if(m >= assets.materials.size()) return false;
+
+    uint32_t nameStart = 0;
+    for(uint32_t i = 0; i < uint32_t(scene.Size()); i++)
+    {
+        if(scene.parents[i] != SceneGraph::NO_PARENT && scene.parents[i] >= i) return false;
+        if(scene.meshes[i] >= assets.meshes.size()) return false;
+        if(scene.materials[i] >= assets.materials.size()) return false;
+        if(scene.nameEnds[i] < nameStart || scene.nameEnds[i] > scene.nameChars.size()) return false;
+        nameStart = scene.nameEnds[i];
+    }
+    return true;
+}
+
+bool LoadSceneBinary(SceneGraph& scene, SceneAssets& assets, std::ifstream& file, uint64_t fileSize)
+{
+    SceneFileHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(SceneFileHeader));
+    if(!file || header.magic != SceneFileHeader::MAGIC || header.version != SceneFileHeader::VERSION)
+        return false;
+
+    // Smallest file the counts need (empty strings), nothing is allocated
+    // for a truncated or corrupt header
+    const uint64_t BodyBytes = 4 * sizeof(uint32_t) + 5 * sizeof(double) + 3 * sizeof(glm::dvec2);
+    uint64_t minSize = sizeof(SceneFileHeader) +
+                       (uint64_t(header.textureCount) + header.meshCount) * 2 * sizeof(uint32_t) +
+                       uint64_t(header.materialCount) * (sizeof(uint32_t) + sizeof(SceneMaterial)) +
+                       uint64_t(header.beltMaterialCount) * sizeof(uint32_t) +
+                       header.nameBytes + uint64_t(header.bodyCount) * BodyBytes;
+    if(minSize > fileSize) return false;
+
+    assets.textures.resize(header.textureCount);
+    for(SceneAssets::Resource& t : assets.textures)
+        if(!ReadString(file, t.name) || !ReadString(file, t.path)) return false;
+    assets.meshes.resize(header.meshCount);
+    for(SceneAssets::Resource& m : assets.meshes)
+        if(!ReadString(file, m.name) || !ReadString(file, m.path)) return false;
+    assets.materialNames.resize(header.materialCount);
+    for(std::string& name : assets.materialNames)
+        if(!ReadString(file, name)) return false;
+    ReadArray(file, assets.materials, header.materialCount);
+    ReadArray(file, assets.beltMaterials, header.beltMaterialCount);
+    assets.beltInner = header.beltInner;
+    assets.beltOuter = header.beltOuter;
+
+    // Arrays of the graph as they are, one read each
+    size_t n = header.bodyCount;
+    scene.nameChars.resize(header.nameBytes);
+    file.read(scene.nameChars.data(), std::streamsize(header.nameBytes));
+    ReadArray(file, scene.nameEnds, n);
+    ReadArray(file, scene.parents, n);
+    ReadArray(file, scene.meshes, n);
+    ReadArray(file, scene.materials, n);
+    ReadArray(file, scene.orbitRadius, n);
+    ReadArray(file, scene.orbitSpeed, n);
+    ReadArray(file, scene.orbitPhase, n);
+    ReadArray(file, scene.scale, n);
+    ReadArray(file, scene.spinSpeed, n);
+    ReadArray(file, scene.oscAmplitude, n);
+    ReadArray(file, scene.oscFrequency, n);
+    ReadArray(file, scene.oscPhase, n);
+    scene.world.assign(n, glm::dmat4(1.0));
+    return bool(file) && IsValid(scene, assets);
+}
+
+}
+
+
+uint32_t SceneGraph::Add(std::string_view name, uint32_t parent, const BodyOrbit& orbit,
+                         uint32_t mesh, uint32_t material)
+{
+    uint32_t index = uint32_t(Size());
+    if(parent != NO_PARENT && parent >= index)
+    {
+        std::fprintf(stderr, "Parent of body \"%.*s\" is not in the scene!\n",
+                     int(name.size()), name.data());
+        std::exit(EXIT_FAILURE);
+    }
+
+    nameChars.append(name);
+    nameEnds.push_back(uint32_t(nameChars.size()));
+    parents.push_back(parent);
+    meshes.push_back(mesh);
+    materials.push_back(material);
+    orbitRadius.push_back(orbit.orbitRadius);
+    orbitSpeed.push_back(orbit.orbitSpeed);
+    orbitPhase.push_back(orbit.orbitPhase);
+    scale.push_back(orbit.scale);
+    spinSpeed.push_back(orbit.spinSpeed);
+    oscAmplitude.push_back(orbit.oscAmplitude);
+    oscFrequency.push_back(orbit.oscFrequency);
+    oscPhase.push_back(orbit.oscPhase);
+    world.push_back(glm::dmat4(1.0));
+    return index;
+}
+
+void SceneGraph::Reserve(size_t count, size_t nameBytes)
+{
+    nameChars.reserve(nameBytes);
+    nameEnds.reserve(count);
+    parents.reserve(count);
+    meshes.reserve(count);
+    materials.reserve(count);
+    orbitRadius.reserve(count);
+    orbitSpeed.reserve(count);
+    orbitPhase.reserve(count);
+    scale.reserve(count);
+    spinSpeed.reserve(count);
+    oscAmplitude.reserve(count);
+    oscFrequency.reserve(count);
+    oscPhase.reserve(count);
+    world.reserve(count);
+}
+
+void SceneGraph::Update(double simTime)
+{
+    size_t count = Size();
+    for(size_t i = 0; i < count; i++)
+    {
+        double angle = orbitSpeed[i] * simTime + orbitPhase[i];
+        double c = std::cos(angle);
+        double s = std::sin(angle);
+        glm::dvec2 osc = oscAmplitude[i] * glm::sin(oscFrequency[i] * simTime + oscPhase[i]);
+        double height = osc.x + osc.y;
+        double k = scale[i];
+
+        // Same as rotate(angle, Y) * translate(radius, height, 0) * scale(k)
+        glm::dmat4 local;
+        local[0] = glm::dvec4( c * k, 0.0, -s * k, 0.0);
+        local[1] = glm::dvec4(   0.0,   k,    0.0, 0.0);
+        local[2] = glm::dvec4( s * k, 0.0,  c * k, 0.0);
+        local[3] = glm::dvec4( c * orbitRadius[i], height, -s * orbitRadius[i], 1.0);
+
+        uint32_t parent = parents[i];
+        world[i] = (parent == NO_PARENT) ? local : world[parent] * local;
+    }
+}
+
+uint32_t SceneGraph::Find(std::string_view name) const
+{
+    for(uint32_t i = 0; i < uint32_t(Size()); i++)
+        if(Name(i) == name) return i;
+    return NO_PARENT;
+}
+
+uint32_t SceneGraph::Get(std::string_view name) const
+{
+    uint32_t body = Find(name);
+    if(body == NO_PARENT)
+    {
+        std::fprintf(stderr, "Body \"%.*s\" is not in the scene!\n",
+                     int(name.size()), name.data());
+        std::exit(EXIT_FAILURE);
+    }
+    return body;
+}
+
+void LoadScene(SceneGraph& scene, SceneAssets& assets, const std::string& path)
+{
+    scene = SceneGraph();
+    assets = SceneAssets();
+
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+    {
+        std::fprintf(stderr, "Unable to open scene \"%s\"!\n", path.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    file.seekg(0, std::ios::end);
+    size_t fileSize = size_t(file.tellg());
+    file.seekg(0);
+    uint32_t magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+    file.clear();
+    file.seekg(0);
+    if(magic == SceneFileHeader::MAGIC)
+    {
+        if(!LoadSceneBinary(scene, assets, file, fileSize))
+        {
+            std::fprintf(stderr, "Scene \"%s\" is not a valid binary scene!\n", path.c_str());
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        std::string text(fileSize, '\0');
+        file.read(text.data(), std::streamsize(fileSize));
+        LoadSceneText(scene, assets, path, text);
+    }
+
+    std::printf("Scene \"%s\" is loaded, %zu bodies, %zu meshes, %zu textures, %zu materials.\n",
+                path.c_str(), scene.Size(), assets.meshes.size(),
+                assets.textures.size(), assets.materials.size());
+}
+
+void SaveSceneBinary(const SceneGraph& scene, const SceneAssets& assets, const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    SceneFileHeader header =
+    {
+        .magic              = SceneFileHeader::MAGIC,
+        .version            = SceneFileHeader::VERSION,
+        .textureCount       = uint32_t(assets.textures.size()),
+        .meshCount          = uint32_t(assets.meshes.size()),
+        .materialCount      = uint32_t(assets.materials.size()),
+        .beltMaterialCount  = uint32_t(assets.beltMaterials.size()),
+        .bodyCount          = uint32_t(scene.Size()),
+        .nameBytes          = uint32_t(scene.nameChars.size()),
+        .beltInner          = assets.beltInner,
+        .beltOuter          = assets.beltOuter
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(SceneFileHeader));
+    for(const SceneAssets::Resource& t : assets.textures)
+    {
+        WriteString(file, t.name);
+        WriteString(file, t.path);
+    }
+    for(const SceneAssets::Resource& m : assets.meshes)
+    {
+        WriteString(file, m.name);
+        WriteString(file, m.path);
+    }
+    for(const std::string& name : assets.materialNames)
+        WriteString(file, name);
+    WriteArray(file, assets.materials);
+    WriteArray(file, assets.beltMaterials);
+
+    file.write(scene.nameChars.data(), std::streamsize(scene.nameChars.size()));
+    WriteArray(file, scene.nameEnds);
+    WriteArray(file, scene.parents);
+    WriteArray(file, scene.meshes);
+    WriteArray(file, scene.materials);
+    WriteArray(file, scene.orbitRadius);
+    WriteArray(file, scene.orbitSpeed);
+    WriteArray(file, scene.orbitPhase);
+    WriteArray(file, scene.scale);
+    WriteArray(file, scene.spinSpeed);
+    WriteArray(file, scene.oscAmplitude);
+    WriteArray(file, scene.oscFrequency);
+    WriteArray(file, scene.oscPhase);
+    if(!file)
+        std::printf("[WARNING]: Unable to write scene \"%s\".\n", path.c_str());
+}
+
+void GenerateBodies(SceneGraph& scene, const SceneAssets& assets, uint32_t count, uint32_t seed)
+{
+    if(assets.meshes.empty() || assets.materials.empty())
+    {
+        std::fprintf(stderr, "Scene has no meshes or materials to generate bodies with!\n");
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    auto Pick = [&](size_t size){ return uint32_t(unit(rng) * double(size)) % uint32_t(size); };
+
+    const size_t MaxNameLength = 16;
+    size_t first = scene.Size();
+    scene.Reserve(first + count, scene.nameChars.size() + size_t(count) * MaxNameLength);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        // Any earlier body may be the parent, so the hierarchy gets deep;
+        // Size() stands for the root so an empty scene still gets bodies.
+        // Orbits are outside the parent (unit sphere meshes)
+        BodyOrbit orbit =
+        {
+            .orbitRadius    = glm::mix(2.0, 6.0, unit(rng)),
+            .orbitSpeed     = glm::mix(0.2, 2.0, unit(rng)),
+            .orbitPhase     = unit(rng) * glm::two_pi<double>(),
+            .scale          = glm::mix(0.05, 0.3, unit(rng)),
+            .spinSpeed      = glm::mix(-2.0, 2.0, unit(rng)),
+            .oscAmplitude   = glm::dvec2(0.2 * unit(rng), 0.0),
+            .oscFrequency   = glm::dvec2(glm::mix(0.2, 1.0, unit(rng)), 0.0)
+        };
+
+        char name[MaxNameLength];
+        int length = std::snprintf(name, sizeof(name), "Body%zu", first + i);
+        uint32_t parent = Pick(scene.Size() + 1);
+        if(parent == scene.Size())
+            parent = SceneGraph::NO_PARENT;
+        scene.Add(std::string_view(name, size_t(length)), parent, orbit,
+                  Pick(assets.meshes.size()), Pick(assets.materials.size()));
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utility.h"
+
+// Orbit of a body around its parent, the local transform is
+//  rotate(orbitSpeed * t + orbitPhase, Y) * translate(orbitRadius, y(t), 0) * scale(scale)
+// where the height oscillates as the sum of two sines;
+//  y(t) = sum(oscAmplitude[k] * sin(oscFrequency[k] * t + oscPhase[k]))
+// Spin is around the body's own Y axis, it is not part of the world
+// matrix (children do not inherit it), it is applied when drawing.
+struct BodyOrbit
+{
+    double      orbitRadius     = 0.0;
+    double      orbitSpeed      = 0.0;  // Radians per simulation second
+    double      orbitPhase      = 0.0;
+    double      scale           = 1.0;  // Relative to the parent's scale
+    double      spinSpeed       = 0.0;  // Radians per simulation second
+    glm::dvec2  oscAmplitude    = glm::dvec2(0.0);
+    glm::dvec2  oscFrequency    = glm::dvec2(0.0);
+    glm::dvec2  oscPhase        = glm::dvec2(0.0);
+};
+
+// Surface of a body, textures are indices to "SceneAssets::textures"
+struct SceneMaterial
+{
+    static constexpr uint32_t NO_TEXTURE = UINT32_MAX;
+
+    uint32_t    albedo          = NO_TEXTURE;
+    // Earth only (night lights, cloud layer & ocean mask)
+    uint32_t    night           = NO_TEXTURE;
+    uint32_t    clouds          = NO_TEXTURE;
+    uint32_t    specularMap     = NO_TEXTURE;
+    // Instanced bodies only, the lit variants have their own
+    float       ambient         = 0.05f;
+    float       specular        = 0.1f;
+    float       shininess       = 8.0f;
+};
+
+// Resources of a scene, bodies refer to them by index.
+// These are few (not per body), the renderer loads them once.
+struct SceneAssets
+{
+    struct Resource
+    {
+        std::string name;
+        std::string path;
+    };
+
+    std::vector<Resource>       textures;
+    std::vector<Resource>       meshes;
+    std::vector<std::string>    materialNames;
+    std::vector<SceneMaterial>  materials;
+    // Asteroid belt around the Earth, its bodies pick one of the
+    // albedo textures of "beltMaterials"
+    float                       beltInner       = 0.0f;
+    float                       beltOuter       = 0.0f;
+    std::vector<uint32_t>       beltMaterials;
+};
+
+// Hierarchy of the bodies (data-oriented)
+//
+// Every attribute is a separate array indexed by the body. Parents are
+// always stored before their children (topological order), so "Update"
+// is a single linear pass over the arrays; the parent's world matrix is
+// already computed when a child reads it. World matrices are in double
+// precision (see "CameraRelative"). Names are packed into a single
+// string, so a reserved graph adds bodies without any heap allocation.
+struct SceneGraph
+{
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    std::string                 nameChars;  // All names back to back
+    std::vector<uint32_t>       nameEnds;   // End of each name in "nameChars"
+    std::vector<uint32_t>       parents;    // Less than the body's own index
+    std::vector<uint32_t>       meshes;     // Indices to "SceneAssets"
+    std::vector<uint32_t>       materials;
+    // Orbits (see "BodyOrbit")
+    std::vector<double>         orbitRadius;
+    std::vector<double>         orbitSpeed;
+    std::vector<double>         orbitPhase;
+    std::vector<double>         scale;
+    std::vector<double>         spinSpeed;
+    std::vector<glm::dvec2>     oscAmplitude;
+    std::vector<glm::dvec2>     oscFrequency;
+    std::vector<glm::dvec2>     oscPhase;
+    // Output of "Update"
+    std::vector<glm::dmat4>     world;
+
+    // Parent must already be in the graph (or "NO_PARENT"),
+    // returns the index of the body
+    uint32_t            Add(std::string_view name, uint32_t parent, const BodyOrbit&,
+                            uint32_t mesh, uint32_t material);
+    void                Reserve(size_t count, size_t nameBytes);
+    // World matrices of all bodies at "simTime"
+    void                Update(double simTime);
+
+    // "NO_PARENT" if there is no such body
+    uint32_t            Find(std::string_view name) const;
+    // Fails if there is no such body
+    uint32_t            Get(std::string_view name) const;
+    size_t              Size() const;
+    std::string_view    Name(uint32_t body) const;
+    glm::dvec3          Position(uint32_t body) const;
+};
+
+// Scene files define the assets & the bodies, either as text;
+//
+//  # Comment
+//  texture  <name> <path>
+//  mesh     <name> <path>
+//  material <name> <albedo> <night> <clouds> <specular map> <ambient> <specular> <shininess>
+//  body     <name> <parent> <mesh> <material> <orbit radius> <orbit speed> <orbit phase>
+//           <scale> <spin speed> <osc amplitude x y> <osc frequency x y> <osc phase x y>
+//  belt     <inner radius> <outer radius> <material>...
+//
+// (names are single words, "-" is no texture / no parent; every entry
+// refers only to the ones above it) or in the binary form, the same
+// arrays as "SceneGraph" back to back, for large scenes. The form is
+// detected by the binary magic. Bodies are loaded into a reserved graph,
+// without any per-body heap allocation. Both fail on a malformed file.
+void    LoadScene(SceneGraph& scene, SceneAssets& assets, const std::string& path);
+void    SaveSceneBinary(const SceneGraph& scene, const SceneAssets& assets, const std::string& path);
+// Appends "count" bodies with random orbits around random bodies of
+// the scene (deep hierarchies, for testing the scaling)
+void    GenerateBodies(SceneGraph& scene, const SceneAssets& assets, uint32_t count, uint32_t seed);
+
+inline size_t SceneGraph::Size() const
+{
+    return parents.size();
+}
+
+inline std::string_view SceneGraph::Name(uint32_t body) const
+{
+    assert(body < nameEnds.size());
+    uint32_t start = (body == 0) ? 0 : nameEnds[body - 1];
+    return std::string_view(nameChars).substr(start, nameEnds[body] - start);
+}
+
+inline glm::dvec3 SceneGraph::Position(uint32_t body) const
+{
+    assert(body < world.size());
+    return glm::dvec3(world[body][3]);
+}
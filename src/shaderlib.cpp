@@ -0,0 +1,352 @@
+#include "shaderlib.h"
+
+#include <filesystem>
+#include <optional>
+
+namespace
+{
+
+struct VariantSources
+{
+    ShaderSource vertex;
+    ShaderSource fragment;
+    bool         shadowed = false;  // Fragment stage gets the shadow defines
+    ShaderSource geometry = {};
+    ShaderSource compute  = {};    // Compute variants have no other stages
+    ShaderSource tessControl    = {};
+    ShaderSource tessEvaluation = {};
+};
+
+// Sources and defines of each variant, indexed by "ShaderVariant"
+const std::array<VariantSources, ShaderLibrary::VARIANT_COUNT>& VariantTable()
+{
+    static const std::string GenericVert    = "shaders/generic.vert";
+    static const std::string DebugFrag      = "shaders/debug.frag";
+    static const std::string InstancedVert  = "shaders/instanced.vert";
+    static const std::string InstancedFrag  = "shaders/instanced.frag";
+    static const std::string ShadowGeom     = "shaders/shadow.geom";
+    static const std::string MomentsComp    = "shaders/shadow_moments.comp";
+    static const std::string SkyVert        = "shaders/sky.vert";
+    static const std::string SkyFrag        = "shaders/sky.frag";
+    static const std::string StarsVert      = "shaders/stars.vert";
+    static const std::string StarsFrag      = "shaders/stars.frag";
+    static const std::string ImpostorVert   = "shaders/impostor.vert";
+    static const std::string PlanetTesc     = "shaders/planet.tesc";
+    static const std::string PlanetTese     = "shaders/planet.tese";
+    static const std::string TerrainVert    = "shaders/terrain.vert";
+
+    static const std::array<VariantSources, ShaderLibrary::VARIANT_COUNT> Table =
+    {
+        // SHADOW_DEPTH (no fragment stage, depth is written by the rasterizer)
+        // Geometry stage replicates triangles to each cascade
+        VariantSources{{GenericVert, {"SHADOW_DEPTH"}}, {}, false, {ShadowGeom, {}}},
+        // SKY
+        VariantSources{{SkyVert, {}}, {SkyFrag, {}}},
+        // EMISSIVE
+        VariantSources{{GenericVert, {}}, {DebugFrag, {"EMISSIVE"}}},
+        // LIT_EARTH
+        VariantSources{{GenericVert, {}}, {DebugFrag, {"LIT_EARTH", "NIGHT_MAP", "SPEC_MAP"}}, true},
+        // LIT_ROCKY
+        VariantSources{{GenericVert, {}}, {DebugFrag, {"LIT_ROCKY"}}, true},
+        // CLOUDS
+        VariantSources{{GenericVert, {}}, {DebugFrag, {"CLOUDS"}}},
+        // INSTANCED
+        VariantSources{{InstancedVert, {}}, {InstancedFrag, {}}},
+        // EVSM_BLUR_X
+        VariantSources{{}, {}, false, {}, {MomentsComp, {"EVSM_BLUR_X"}}},
+        // EVSM_BLUR_Y
+        VariantSources{{}, {}, false, {}, {MomentsComp, {"EVSM_BLUR_Y"}}},
+        // OCCLUSION_PROXY (no fragment stage, only the samples are counted)
+        VariantSources{{GenericVert, {}}, {}},
+        // STARS
+        VariantSources{{StarsVert, {}}, {StarsFrag, {}}},
+        // IMPOSTOR_EMISSIVE
+        VariantSources{{ImpostorVert, {}}, {DebugFrag, {"EMISSIVE", "IMPOSTOR"}}},
+        // IMPOSTOR_ROCKY
+        VariantSources{{ImpostorVert, {}}, {DebugFrag, {"LIT_ROCKY", "IMPOSTOR"}}, true},
+        // LIT_EARTH_TESSELLATED
+        VariantSources{{GenericVert, {"TESSELLATED"}},
+                       {DebugFrag, {"LIT_EARTH", "NIGHT_MAP", "SPEC_MAP", "TESSELLATED"}}, true,
+                       {}, {}, {PlanetTesc, {}}, {PlanetTese, {}}},
+        // TERRAIN_EARTH (same inputs as the tessellated one)
+        VariantSources{{TerrainVert, {}},
+                       {DebugFrag, {"LIT_EARTH", "NIGHT_MAP", "SPEC_MAP", "TESSELLATED"}}, true}
+    };
+    return Table;
+}
+
+}
+
+uint32_t ShaderLibrary::ShadowTaps(ShadowQuality q)
+{
+    // Each tap is a hardware 2x2 PCF (bilinear compare)
+    switch(q)
+    {
+        case ShadowQuality::LOW:    return 1;
+        case ShadowQuality::MEDIUM: return 4;
+        case ShadowQuality::HIGH:   return 9;
+        default:                    return 4;
+    }
+}
+
+const char* ShaderLibrary::ShadowModeName(ShadowMode m)
+{
+    switch(m)
+    {
+        case ShadowMode::MAP:       return "Shadow Map";
+        case ShadowMode::EVSM:      return "EVSM";
+        case ShadowMode::ANALYTIC:  return "Analytic";
+        default:                    return "Unknown";
+    }
+}
+
+const char* ShaderLibrary::ShadowQualityName(ShadowQuality q)
+{
+    switch(q)
+    {
+        case ShadowQuality::LOW:    return "Low";
+        case ShadowQuality::MEDIUM: return "Medium";
+        case ShadowQuality::HIGH:   return "High";
+        default:                    return "Unknown";
+    }
+}
+
+ShaderLibrary::ShaderLibrary(ShadowMode mode, ShadowQuality quality)
+    : shadowMode(mode)
+    , shadowQuality(quality)
+{
+    // Issue everything first, the driver may compile these concurrently
+    // (GL_KHR_parallel_shader_compile) while we do other work.
+    for(size_t i = 0; i < VARIANT_COUNT; i++)
+    {
+        keys[i] = StageKeys
+        {
+            .vertex   = Issue(ShaderGL::VERTEX, VertexSource(ShaderVariant(i))),
+            .geometry = Issue(ShaderGL::GEOMETRY, GeometrySource(ShaderVariant(i))),
+            .fragment = Issue(ShaderGL::FRAGMENT, FragmentSource(ShaderVariant(i))),
+            .compute  = Issue(ShaderGL::COMPUTE, ComputeSource(ShaderVariant(i))),
+            .tessControl    = Issue(ShaderGL::TESS_CONTROL, TessControlSource(ShaderVariant(i))),
+            .tessEvaluation = Issue(ShaderGL::TESS_EVALUATION, TessEvaluationSource(ShaderVariant(i)))
+        };
+        programs[i].variant = ShaderVariant(i);
+    }
+    std::printf("%zu shader variants are issued (%zu unique programs).\n",
+                VARIANT_COUNT, cache.size());
+}
+
+ShaderSource ShaderLibrary::VertexSource(ShaderVariant v) const
+{
+    return VariantTable()[size_t(v)].vertex;
+}
+
+ShaderSource ShaderLibrary::GeometrySource(ShaderVariant v) const
+{
+    return VariantTable()[size_t(v)].geometry;
+}
+
+ShaderSource ShaderLibrary::FragmentSource(ShaderVariant v) const
+{
+    const VariantSources& sources = VariantTable()[size_t(v)];
+    ShaderSource result = sources.fragment;
+    if(!sources.shadowed) return result;
+
+    // Tap count is irrelevant for the analytic & EVSM shadows
+    if(shadowMode == ShadowMode::ANALYTIC)
+        result.defines.push_back("SHADOW_ANALYTIC");
+    else if(shadowMode == ShadowMode::EVSM)
+        result.defines.push_back("SHADOW_EVSM");
+    else
+        result.defines.push_back("SHADOW_TAPS " + std::to_string(ShadowTaps(shadowQuality)));
+    return result;
+}
+
+ShaderSource ShaderLibrary::ComputeSource(ShaderVariant v) const
+{
+    return VariantTable()[size_t(v)].compute;
+}
+
+ShaderSource ShaderLibrary::TessControlSource(ShaderVariant v) const
+{
+    return VariantTable()[size_t(v)].tessControl;
+}
+
+ShaderSource ShaderLibrary::TessEvaluationSource(ShaderVariant v) const
+{
+    return VariantTable()[size_t(v)].tessEvaluation;
+}
+
+void ShaderLibrary::ReissueShadowed()
+{
+    // Shadowed variants keep their current programs until
+    // the new permutations are ready (see "UpdatePrograms")
+    for(size_t i = 0; i < VARIANT_COUNT; i++)
+    {
+        if(!VariantTable()[i].shadowed) continue;
+        keys[i].fragment = Issue(ShaderGL::FRAGMENT, FragmentSource(ShaderVariant(i)));
+    }
+    // Previously compiled permutations are swapped immediately
+    UpdatePrograms();
+}
+
+void ShaderLibrary::SetShadowMode(ShadowMode m)
+{
+    if(m == shadowMode) return;
+    shadowMode = m;
+    ReissueShadowed();
+    std::printf("Shadow mode: %s\n", ShadowModeName(m));
+}
+
+void ShaderLibrary::SetShadowQuality(ShadowQuality q)
+{
+    if(q == shadowQuality) return;
+    shadowQuality = q;
+    ReissueShadowed();
+    std::printf("Shadow quality: %s (%u taps)\n",
+                ShadowQualityName(q), ShadowTaps(q));
+}
+
+std::string ShaderLibrary::Key(ShaderGL::Type t, const ShaderSource& src)
+{
+    std::string key = std::to_string(uint32_t(t)) + "|" + src.path;
+    for(const std::string& d : src.defines)
+        key += "|" + d;
+    return key;
+}
+
+std::string ShaderLibrary::Issue(ShaderGL::Type t, const ShaderSource& src)
+{
+    // Stage is not used by the variant
+    if(src.path.empty()) return std::string();
+
+    std::string key = Key(t, src);
+    if(!cache.contains(key))
+    {
+        cache.emplace(key, CacheEntry{t, src, ShaderGL(t, src.path, src.defines)});
+        issuing = true;
+    }
+    return key;
+}
+
+void ShaderLibrary::Reload(const std::vector<std::string>& files)
+{
+    for(const std::string& file : files)
+    {
+        // File may be removed/renamed after the event
+        if(!std::filesystem::exists(file)) continue;
+
+        for(const auto& [key, entry] : cache)
+        {
+            if(entry.source.path != file) continue;
+            // Newer save overrides the pending one
+            reloads.insert_or_assign(key, ShaderGL(entry.type, entry.source.path,
+                                                   entry.source.defines));
+        }
+    }
+}
+
+void ShaderLibrary::UpdatePrograms()
+{
+    for(size_t i = 0; i < VARIANT_COUNT; i++)
+    {
+        // Unused stages are bound as zero
+        auto StageId = [this](const std::string& key) -> std::optional<GLuint>
+        {
+            if(key.empty()) return 0u;
+            const ShaderGL& shader = cache.at(key).shader;
+            if(shader.status != ShaderGL::READY) return std::nullopt;
+            return shader.shaderId;
+        };
+        std::optional<GLuint> vShaderId = StageId(keys[i].vertex);
+        std::optional<GLuint> gShaderId = StageId(keys[i].geometry);
+        std::optional<GLuint> fShaderId = StageId(keys[i].fragment);
+        std::optional<GLuint> cShaderId = StageId(keys[i].compute);
+        std::optional<GLuint> tcShaderId = StageId(keys[i].tessControl);
+        std::optional<GLuint> teShaderId = StageId(keys[i].tessEvaluation);
+        if(!vShaderId || !gShaderId || !fShaderId || !cShaderId ||
+           !tcShaderId || !teShaderId) continue;
+
+        if(!programs[i].ready) readyCount++;
+        programs[i].vShaderId = *vShaderId;
+        programs[i].gShaderId = *gShaderId;
+        programs[i].fShaderId = *fShaderId;
+        programs[i].cShaderId = *cShaderId;
+        programs[i].tcShaderId = *tcShaderId;
+        programs[i].teShaderId = *teShaderId;
+        programs[i].ready = true;
+    }
+}
+
+bool ShaderLibrary::Poll()
+{
+    if(!reloads.empty())
+    {
+        bool batchDone = true;
+        for(auto& [key, shader] : reloads)
+            batchDone &= shader.Poll();
+
+        // Swap all of the batch at once, so a frame never mixes
+        // stages of different edits
+        if(batchDone)
+        {
+            size_t swapCount = 0;
+            for(auto& [key, shader] : reloads)
+            {
+                if(shader.status == ShaderGL::FAILED)
+                {
+                    std::printf("[WARNING]: Keeping the last good program of \"%s\" [%s].\n",
+                                shader.path.c_str(), shader.defineList.c_str());
+                    continue;
+                }
+                cache.at(key).shader = std::move(shader);
+                swapCount++;
+            }
+            reloads.clear();
+            UpdatePrograms();
+            std::printf("%zu shaders are reloaded.\n", swapCount);
+        }
+    }
+
+    if(!issuing) return readyCount == VARIANT_COUNT;
+
+    issuing = false;
+    for(auto& [key, entry] : cache)
+    {
+        if(entry.shader.status != ShaderGL::PENDING) continue;
+
+        issuing |= !entry.shader.Poll();
+        if(entry.shader.status != ShaderGL::FAILED) continue;
+
+        // Variants that already have a program keep it,
+        // others have nothing to fall back to
+        for(size_t i = 0; i < VARIANT_COUNT; i++)
+        {
+            if(keys[i].vertex != key && keys[i].geometry != key &&
+               keys[i].fragment != key && keys[i].compute != key &&
+               keys[i].tessControl != key && keys[i].tessEvaluation != key) continue;
+            if(programs[i].ready)
+            {
+                std::printf("[WARNING]: Keeping the last good program of \"%s\" [%s].\n",
+                            entry.shader.path.c_str(), entry.shader.defineList.c_str());
+                continue;
+            }
+            std::fprintf(stderr, "Shader \"%s\" [%s] failed, terminating...\n",
+                         entry.shader.path.c_str(), entry.shader.defineList.c_str());
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    UpdatePrograms();
+
+    if(!issuing)
+        std::printf("%zu shader variants are ready (%zu unique programs).\n",
+                    VARIANT_COUNT, cache.size());
+    return readyCount == VARIANT_COUNT;
+}
+
+void ShaderLibrary::WaitAll()
+{
+    for(auto& [key, entry] : cache)
+        entry.shader.Wait();
+    for(auto& [key, shader] : reloads)
+        shader.Wait();
+    Poll();
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "utility.h"
+
+// Specialized programs that are compiled from the shared sources.
+// Draw calls select one of these instead of branching on a mode uniform.
+enum class ShaderVariant : uint32_t
+{
+    SHADOW_DEPTH,   // Depth only shadow pass, no fragment stage
+    SKY,            // Fullscreen triangle, sky cubemap
+    EMISSIVE,       // Sun, just white
+    LIT_EARTH,      // Lit & shadowed, with night and specular maps
+    LIT_ROCKY,      // Lit & shadowed rocky body (Moon, Jupiter)
+    CLOUDS,         // Lit, alpha blended cloud layer
+    INSTANCED,      // Instanced small bodies
+    EVSM_BLUR_X,    // Compute, shadow map to EVSM moments + horizontal blur
+    EVSM_BLUR_Y,    // Compute, vertical blur of the moments
+    OCCLUSION_PROXY,// Bounding box of the occlusion queries, no fragment stage
+    STARS,          // Point sprites of the star catalog
+    IMPOSTOR_EMISSIVE,  // Ray-cast sphere on a quad, Sun
+    IMPOSTOR_ROCKY,     // Ray-cast sphere on a quad, lit & shadowed (Moon, Jupiter)
+    LIT_EARTH_TESSELLATED,  // LIT_EARTH on icosphere patches refined on the sphere
+    TERRAIN_EARTH,          // LIT_EARTH on the quadtree terrain chunks
+
+    COUNT
+};
+
+// Vertex & fragment programs of a variant,
+// these are bound to "GLState::renderPipeline" by the draw functions.
+// Zero means the stage is not used (i.e. depth only variants).
+// Compute variants only have the compute stage.
+// Draws of the tessellated variants unbind the tessellation stages
+// afterwards, other draws do not touch them.
+// Draws that use a variant which is not "ready" yet are skipped.
+struct ShaderProgram
+{
+    ShaderVariant   variant   = ShaderVariant::COUNT;
+    GLuint          vShaderId = 0;
+    GLuint          gShaderId = 0;
+    GLuint          fShaderId = 0;
+    GLuint          cShaderId = 0;
+    GLuint          tcShaderId = 0;
+    GLuint          teShaderId = 0;
+    bool            ready     = false;
+};
+
+// How the lit variants compute shadows, these are recompiled
+// with the corresponding defines when it is changed
+enum class ShadowMode : uint32_t
+{
+    MAP,            // Cascaded shadow maps
+    EVSM,           // Prefiltered exponential variance shadow maps ("SHADOW_EVSM")
+    ANALYTIC,       // Sphere occluders vs. the Sun's disk ("SHADOW_ANALYTIC"), no shadow pass
+
+    COUNT
+};
+
+// Tap count of the shadow filter, lit variants are recompiled
+// with the corresponding "SHADOW_TAPS" when it is changed
+enum class ShadowQuality : uint32_t
+{
+    LOW,            // Single hardware PCF tap
+    MEDIUM,         // 4 taps
+    HIGH,           // 9 taps (Poisson disk)
+
+    COUNT
+};
+
+struct ShaderSource
+{
+    std::string                 path;       // Empty if the stage is not used
+    std::vector<std::string>    defines;
+};
+
+struct ShaderLibrary
+{
+    static constexpr size_t VARIANT_COUNT = size_t(ShaderVariant::COUNT);
+
+    struct StageKeys
+    {
+        std::string vertex;
+        std::string geometry;
+        std::string fragment;
+        std::string compute;
+        std::string tessControl;
+        std::string tessEvaluation;
+    };
+
+    struct CacheEntry
+    {
+        ShaderGL::Type  type;
+        ShaderSource    source;
+        ShaderGL        shader;
+    };
+
+    // Every unique (stage, path, defines) is compiled once
+    std::unordered_map<std::string, CacheEntry> cache;
+    // Recompiled shaders (hot reload), swapped into "cache" by "Poll"
+    // when the whole batch is done. Failed ones are discarded so the
+    // last good program stays in use.
+    std::unordered_map<std::string, ShaderGL>   reloads;
+    std::array<StageKeys, VARIANT_COUNT>        keys;
+    std::array<ShaderProgram, VARIANT_COUNT>    programs;
+    size_t                                      readyCount = 0;
+    // There are issued shaders in "cache" that are not polled to completion
+    bool                                        issuing = false;
+    ShadowMode                                  shadowMode;
+    ShadowQuality                               shadowQuality;
+
+    // Constructors, Movement & Destructor
+    // Constructor issues the compilation of every variant up front,
+    // then "Poll" (each frame) or "WaitAll" makes them ready.
+                    ShaderLibrary(ShadowMode = ShadowMode::MAP,
+                                  ShadowQuality = ShadowQuality::MEDIUM);
+                    ShaderLibrary(const ShaderLibrary&) = delete;
+                    ShaderLibrary(ShaderLibrary&&) = delete;
+    ShaderLibrary&  operator=(const ShaderLibrary&) = delete;
+    ShaderLibrary&  operator=(ShaderLibrary&&) = delete;
+                    ~ShaderLibrary() = default;
+
+    // Issues the shader if it is not in the cache, returns its cache key
+    std::string             Issue(ShaderGL::Type, const ShaderSource&);
+    // Re-issues every shader whose source is one of the "files",
+    // rest of the shaders are not touched
+    void                    Reload(const std::vector<std::string>& files);
+    // Non-blocking, returns true when every variant is ready.
+    // Must be called at the frame boundary since it may swap programs.
+    bool                    Poll();
+    void                    WaitAll();
+    // Issues the lit variants with the new shadow defines, current
+    // programs are used until they are ready
+    void                    SetShadowMode(ShadowMode);
+    void                    SetShadowQuality(ShadowQuality);
+    const ShaderProgram&    operator[](ShaderVariant) const;
+
+    ShaderSource            VertexSource(ShaderVariant) const;
+    ShaderSource            GeometrySource(ShaderVariant) const;
+    ShaderSource            FragmentSource(ShaderVariant) const;
+    ShaderSource            ComputeSource(ShaderVariant) const;
+    ShaderSource            TessControlSource(ShaderVariant) const;
+    ShaderSource            TessEvaluationSource(ShaderVariant) const;
+
+    static std::string      Key(ShaderGL::Type, const ShaderSource&);
+    static uint32_t         ShadowTaps(ShadowQuality);
+    static const char*      ShadowModeName(ShadowMode);
+    static const char*      ShadowQualityName(ShadowQuality);
+
+    private:
+    // Refreshes the program ids of the variants from "cache"
+    void                    UpdatePrograms();
+    void                    ReissueShadowed();
+};
+
+inline const ShaderProgram& ShaderLibrary::operator[](ShaderVariant v) const
+{
+    assert(v != ShaderVariant::COUNT);
+    return programs[size_t(v)];
+}
@@ -0,0 +1,276 @@
+#include "shadows.h"
+
+#include <glm/ext.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+glm::vec4 SphereFromModel(const glm::mat4& model)
+{
+    // Unit sphere meshes, scale is uniform
+    return glm::vec4(glm::vec3(model[3]), glm::length(glm::vec3(model[0])));
+}
+
+ShadowCascadesGL::ShadowCascadesGL(int32_t res)
+    : resolution(res)
+{
+    glGenBuffers(1, &uBufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, uBufferId);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(Data), nullptr,
+                    GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Sampled with "sampler2DArrayShadow", linear filter with compare
+    // mode gives 2x2 PCF per fetch. Border is depth 1.0 (not shadowed)
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24,
+                   resolution, resolution, GLsizei(CASCADE_COUNT));
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+uint32_t ShadowCascadesGL::Update(const CascadeParams& p,
+                                  const std::vector<glm::vec4>& casters)
+{
+    frame++;
+    glm::mat4 invView = glm::inverse(p.view);
+    float tanHalfFov = std::tan(p.fovY * 0.5f);
+
+    uint32_t renderMask = 0;
+    float sliceNear = p.zNear;
+    for(uint32_t i = 0; i < CASCADE_COUNT; i++)
+    {
+        Cascade& cascade = cascades[i];
+
+        // Practical split scheme (blend of log & uniform splits)
+        float t = float(i + 1) / float(CASCADE_COUNT);
+        float logSplit = p.zNear * std::pow(p.shadowDistance / p.zNear, t);
+        float uniSplit = p.zNear + (p.shadowDistance - p.zNear) * t;
+        float sliceFar = glm::mix(uniSplit, logSplit, SPLIT_LAMBDA);
+        splits[i] = sliceFar;
+
+        // Corners of the frustum slice in world space
+        std::array<glm::vec4, 8> worldCorners;
+        for(uint32_t c = 0; c < 8; c++)
+        {
+            float d = (c < 4) ? sliceNear : sliceFar;
+            float x = ((c & 0x1) ? 1.0f : -1.0f) * d * tanHalfFov * p.aspect;
+            float y = ((c & 0x2) ? 1.0f : -1.0f) * d * tanHalfFov;
+            worldCorners[c] = invView * glm::vec4(x, y, -d, 1.0f);
+        }
+        sliceNear = sliceFar;
+
+        // XY extent is the bounding sphere of the slice; it does not change
+        // when the camera rotates so the texel size stays constant.
+        glm::vec3 worldCenter = glm::vec3(0.0f);
+        for(const glm::vec4& c : worldCorners) worldCenter += glm::vec3(c);
+        worldCenter /= 8.0f;
+        float radius = 0.0f;
+        for(const glm::vec4& c : worldCorners)
+            radius = std::max(radius, glm::distance(glm::vec3(c), worldCenter));
+        // Quantize to avoid float noise changing the texel size
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        float texelSize = 2.0f * radius / float(resolution);
+
+        // Keep the cached light direction while the farthest caster point
+        // moves less than the threshold
+        float maxAngle = TEXEL_THRESHOLD * texelSize / (2.0f * radius + p.casterExtent);
+        glm::vec3 lightDir = p.lightDir;
+        if(cascade.valid &&
+           glm::dot(cascade.lightDir, p.lightDir) >= std::cos(maxAngle))
+            lightDir = cascade.lightDir;
+
+        // Light space rotation, light looks along "-lightDir"
+        // (+Z is towards the light)
+        glm::vec3 lightUp = (std::abs(lightDir.y) > 0.99f) ? glm::vec3(1, 0, 0)
+                                                           : glm::vec3(0, 1, 0);
+        glm::dmat4 lightRot = glm::lookAt(glm::dvec3(0.0), -glm::dvec3(lightDir),
+                                          glm::dvec3(lightUp));
+
+        // Z range is fitted to the corners (depth precision),
+        // light space is in world coordinates (not camera-relative)
+        glm::dvec3 originLight = glm::dvec3(lightRot * glm::dvec4(p.origin, 1.0));
+        glm::dvec3 center = glm::dvec3(lightRot * glm::dvec4(glm::dvec3(worldCenter), 1.0)) + originLight;
+        double minZ = std::numeric_limits<double>::max();
+        double maxZ = std::numeric_limits<double>::lowest();
+        for(const glm::vec4& c : worldCorners)
+        {
+            double z = (lightRot * glm::dvec4(c)).z + originLight.z;
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+
+        // Snap the center to the texel grid & the Z range to coarse steps,
+        // so that the shadow map texels do not crawl when the camera moves
+        // (and the matrix stays the same for small camera movements)
+        double texel = double(texelSize);
+        center.x = std::floor(center.x / texel) * texel;
+        center.y = std::floor(center.y / texel) * texel;
+        double zStep = double(radius / Z_SNAP_DIVISOR);
+        minZ = std::floor(minZ / zStep) * zStep;
+        maxZ = std::ceil(maxZ / zStep) * zStep;
+
+        // Casters between the slice and the light must be in the map
+        double zNear = -(maxZ + double(p.casterExtent));
+        double zFar = -minZ;
+        // [0, 1] depth (glClipControl), the maps are not reversed; the
+        // range is tight and linear so GL_LESS keeps the precision
+        glm::dmat4 lightProj = glm::orthoZO(center.x - double(radius), center.x + double(radius),
+                                            center.y - double(radius), center.y + double(radius),
+                                            zNear, zFar);
+        glm::dmat4 viewProj = lightProj * lightRot;
+
+        // Dirty check
+        bool dirty = (!cascade.valid || viewProj != cascade.viewProj ||
+                      casters.size() != cascade.casters.size());
+        for(size_t c = 0; !dirty && c < casters.size(); c++)
+        {
+            glm::dvec4 delta = glm::dvec4(casters[c]) + glm::dvec4(p.origin, 0.0) - cascade.casters[c];
+            dirty = (glm::length(glm::dvec3(delta)) + std::abs(delta.w) >
+                     double(TEXEL_THRESHOLD * texelSize));
+        }
+        // Throttle (opt-in), farther cascades are updated less frequently;
+        // by default every dirty cascade is re-rendered
+        uint64_t interval = uint64_t(updateInterval) * (i + 1);
+        bool throttled = (updateInterval > 1 && cascade.valid && frame - cascade.frame < interval);
+        if(!dirty || throttled)
+            continue;
+
+        cascade.valid = true;
+        cascade.viewProj = viewProj;
+        cascade.lightDir = lightDir;
+        cascade.casters.clear();
+        for(const glm::vec4& c : casters)
+            cascade.casters.push_back(glm::dvec4(c) + glm::dvec4(p.origin, 0.0));
+        cascade.frame = frame;
+        cascade.renderCount++;
+        renderMask |= (1u << i);
+
+        data.texelSize[int(i)] = texelSize;
+        data.depthRange[int(i)] = float(zFar - zNear);
+    }
+
+    // Cached cascades are re-based to the current origin
+    bool originMoved = (p.origin != origin);
+    origin = p.origin;
+    glm::dmat4 toWorld = glm::translate(glm::dmat4(1.0), origin);
+    for(uint32_t i = 0; i < CASCADE_COUNT; i++)
+        data.lightViewProj[i] = glm::mat4(cascades[i].viewProj * toWorld);
+
+    if(renderMask != 0 || originMoved)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, uBufferId);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    return renderMask;
+}
+
+void ShadowCascadesGL::Invalidate()
+{
+    for(Cascade& c : cascades) c.valid = false;
+}
+
+void ShadowCascadesGL::ClearLayers(uint32_t mask) const
+{
+    float farDepth = 1.0f;
+    for(uint32_t i = 0; i < CASCADE_COUNT; i++)
+    {
+        if((mask & (1u << i)) == 0) continue;
+        glClearTexSubImage(textureId, 0, 0, 0, GLint(i),
+                           resolution, resolution, 1,
+                           GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+    }
+}
+
+void ShadowCascadesGL::Bind() const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, UBO_CASCADES, uBufferId);
+}
+
+ShadowMomentsGL::ShadowMomentsGL(int32_t res)
+    : resolution(res)
+    , levels(int32_t(std::log2(float(res))) + 1)
+{
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, FORMAT, resolution, resolution,
+                   GLsizei(ShadowCascadesGL::CASCADE_COUNT));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Depth texture is in compare mode for the PCF shaders,
+    // sampling it with a regular sampler is undefined otherwise
+    glGenSamplers(1, &samplerId);
+    glSamplerParameteri(samplerId, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glSamplerParameteri(samplerId, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(samplerId, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+uint32_t ShadowMomentsGL::Update(uint32_t renderMask)
+{
+    uint32_t allMask = (1u << ShadowCascadesGL::CASCADE_COUNT) - 1u;
+    uint32_t filterMask = renderMask | (~validMask & allMask);
+    validMask = allMask;
+    return filterMask;
+}
+
+void ShadowMomentsGL::Invalidate()
+{
+    validMask = 0;
+}
+
+SphereOccludersGL::SphereOccludersGL()
+{
+    glGenBuffers(1, &uBufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, uBufferId);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(Data), nullptr,
+                    GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void SphereOccludersGL::Clear()
+{
+    data.count = 0;
+}
+
+void SphereOccludersGL::AddOccluder(const glm::mat4& model)
+{
+    if(data.count == MAX_OCCLUDERS)
+    {
+        std::fprintf(stderr, "Occluder count exceeds the maximum (%u)!\n",
+                     MAX_OCCLUDERS);
+        std::exit(EXIT_FAILURE);
+    }
+    data.spheres[data.count++] = SphereFromModel(model);
+}
+
+void SphereOccludersGL::SetSun(const glm::mat4& model)
+{
+    data.sun = SphereFromModel(model);
+}
+
+void SphereOccludersGL::Upload() const
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, uBufferId);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void SphereOccludersGL::Bind() const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, UBO_OCCLUDERS, uBufferId);
+}
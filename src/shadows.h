@@ -0,0 +1,277 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "utility.h"
+
+// Cascaded shadow maps
+//
+// Camera frustum (up to "shadowDistance") is split into cascades, each
+// cascade is fitted by an orthographic light projection and rendered
+// into a layer of a single GL_TEXTURE_2D_ARRAY (geometry shader instancing,
+// see "shadow.geom"). Lit shaders pick the finest cascade that covers
+// the fragment.
+//
+// The shadow map persists across frames. A cascade is re-rendered only
+// when it is dirty: its (texel snapped) bounds changed, the light turned
+// or a caster moved more than "TEXEL_THRESHOLD" texels. When
+// "updateInterval" is above 1, dirty cascades are also throttled to
+// "updateInterval * (cascade + 1)" frames. Until a cascade is re-rendered,
+// shaders use the matrix it was rendered with.
+//
+// Inputs are camera-relative (floating origin). Snapping & the dirty
+// checks are done in the double precision world space, so the cached
+// layers stay valid while the origin moves; only the uploaded matrices
+// are re-based every frame.
+struct CascadeParams
+{
+    glm::mat4   view;               // Camera
+    glm::dvec3  origin;             // World position of the camera-relative space
+    float       fovY;               // Radians
+    float       aspect;
+    float       zNear;
+    float       shadowDistance;     // Farthest shadowed distance from the camera
+    glm::vec3   lightDir;           // Towards the light (directional)
+    float       casterExtent;       // Casters this far towards the light are included
+};
+
+// Bounding sphere (xyz: center, w: radius) of a unit sphere mesh
+// transformed by "model" (scale is uniform)
+glm::vec4 SphereFromModel(const glm::mat4& model);
+
+struct ShadowCascadesGL
+{
+    // These must match "shadow.geom" & "debug.frag"
+    static constexpr uint32_t   CASCADE_COUNT   = 4;
+    static constexpr GLuint     UBO_CASCADES    = 0;
+    // Log/uniform split blend (1 is fully logarithmic)
+    static constexpr float      SPLIT_LAMBDA    = 0.75f;
+    // Casters & the light may move this many texels before a re-render
+    static constexpr float      TEXEL_THRESHOLD = 0.5f;
+    // Z range is snapped to "radius / Z_SNAP_DIVISOR" steps
+    static constexpr float      Z_SNAP_DIVISOR  = 8.0f;
+
+    // std140 layout of the "ShadowCascades" uniform block
+    struct Data
+    {
+        std::array<glm::mat4, CASCADE_COUNT> lightViewProj;
+        glm::vec4   texelSize;      // World size of a texel of each cascade
+        glm::vec4   depthRange;     // World depth range of each cascade
+    };
+    static_assert(sizeof(Data) == CASCADE_COUNT * 64 + 32, "Data must match std140 layout!");
+
+    // What the cached layer of a cascade is rendered with
+    struct Cascade
+    {
+        bool                    valid       = false;
+        glm::dmat4              viewProj    = glm::dmat4(1.0);  // World space
+        glm::vec3               lightDir    = glm::vec3(0.0f);
+        std::vector<glm::dvec4> casters;                        // World space
+        uint64_t                frame       = 0;
+        uint64_t                renderCount = 0;
+    };
+
+    GLuint      uBufferId       = 0;
+    GLuint      textureId       = 0;    // Depth array, a layer per cascade
+    int32_t     resolution      = 0;
+    uint32_t    updateInterval  = 1;    // In frames, for the first cascade (1: no throttling)
+    uint64_t    frame           = 0;
+    Data        data            = {};   // Camera-relative matrices
+    glm::dvec3  origin          = glm::dvec3(0.0);
+    std::array<Cascade, CASCADE_COUNT> cascades;
+    // View space far distance of each cascade (for statistics/debugging)
+    std::array<float, CASCADE_COUNT> splits = {};
+
+    // Constructors, Movement & Destructor
+                        ShadowCascadesGL(int32_t resolution);
+                        ShadowCascadesGL(const ShadowCascadesGL&) = delete;
+                        ShadowCascadesGL(ShadowCascadesGL&&);
+    ShadowCascadesGL&   operator=(const ShadowCascadesGL&) = delete;
+    ShadowCascadesGL&   operator=(ShadowCascadesGL&&);
+                        ~ShadowCascadesGL();
+
+    // Fits the cascades to the camera frustum and uploads the matrices.
+    // Returns the mask of the cascades that must be re-rendered this frame
+    // ("casters" are the camera-relative bounding spheres of the casters).
+    uint32_t    Update(const CascadeParams&, const std::vector<glm::vec4>& casters);
+    // Every cascade is re-rendered on the next update
+    void        Invalidate();
+    // Clears the layers of the cascades in "mask" to the far plane
+    void        ClearLayers(uint32_t mask) const;
+    void        Bind() const;
+};
+
+inline ShadowCascadesGL::ShadowCascadesGL(ShadowCascadesGL&& other)
+    : uBufferId(other.uBufferId)
+    , textureId(other.textureId)
+    , resolution(other.resolution)
+    , updateInterval(other.updateInterval)
+    , frame(other.frame)
+    , data(other.data)
+    , origin(other.origin)
+    , cascades(std::move(other.cascades))
+    , splits(other.splits)
+{
+    other.uBufferId = 0;
+    other.textureId = 0;
+}
+
+inline ShadowCascadesGL& ShadowCascadesGL::operator=(ShadowCascadesGL&& other)
+{
+    assert(this != &other);
+    if(uBufferId) glDeleteBuffers(1, &uBufferId);
+    if(textureId) glDeleteTextures(1, &textureId);
+    uBufferId = other.uBufferId;
+    textureId = other.textureId;
+    resolution = other.resolution;
+    updateInterval = other.updateInterval;
+    frame = other.frame;
+    data = other.data;
+    origin = other.origin;
+    cascades = std::move(other.cascades);
+    splits = other.splits;
+    other.uBufferId = 0;
+    other.textureId = 0;
+    return *this;
+}
+
+inline ShadowCascadesGL::~ShadowCascadesGL()
+{
+    if(uBufferId) glDeleteBuffers(1, &uBufferId);
+    if(textureId) glDeleteTextures(1, &textureId);
+}
+
+// Exponential variance shadow maps (EVSM)
+//
+// Filterable representation of the cascades; every re-rendered cascade is
+// warped into moments at half resolution and blurred by a separable
+// compute pass ("shadow_moments.comp"), then the mip chain is rebuilt.
+// Lit shaders do a single trilinear fetch per fragment regardless of the
+// penumbra size.
+struct ShadowMomentsGL
+{
+    // These must match "shadow_moments.comp" & "debug.frag"
+    static constexpr float      EXPONENT_POS    = 40.0f;
+    static constexpr float      EXPONENT_NEG    = 5.0f;
+    static constexpr GLuint     T_INPUT         = 0;
+    static constexpr GLuint     I_OUTPUT        = 0;
+    static constexpr GLuint     WORK_GROUP_SIZE = 8;
+    // 32-bit floats are required by the positive exponent
+    static constexpr GLenum     FORMAT          = GL_RGBA32F;
+
+    GLuint      textureId   = 0;    // Moments array, a layer per cascade
+    GLuint      samplerId   = 0;    // Reads the shadow map without comparison
+    int32_t     resolution  = 0;
+    int32_t     levels      = 0;
+    uint32_t    validMask   = 0;    // Layers that are filtered since the last invalidation
+
+    // Constructors, Movement & Destructor
+                        ShadowMomentsGL(int32_t resolution);
+                        ShadowMomentsGL(const ShadowMomentsGL&) = delete;
+                        ShadowMomentsGL(ShadowMomentsGL&&);
+    ShadowMomentsGL&    operator=(const ShadowMomentsGL&) = delete;
+    ShadowMomentsGL&    operator=(ShadowMomentsGL&&);
+                        ~ShadowMomentsGL();
+
+    // Returns the layers that must be filtered this frame (re-rendered
+    // cascades & the ones that are not filtered yet), marks them valid
+    uint32_t    Update(uint32_t renderMask);
+    void        Invalidate();
+};
+
+inline ShadowMomentsGL::ShadowMomentsGL(ShadowMomentsGL&& other)
+    : textureId(other.textureId)
+    , samplerId(other.samplerId)
+    , resolution(other.resolution)
+    , levels(other.levels)
+    , validMask(other.validMask)
+{
+    other.textureId = 0;
+    other.samplerId = 0;
+}
+
+inline ShadowMomentsGL& ShadowMomentsGL::operator=(ShadowMomentsGL&& other)
+{
+    assert(this != &other);
+    if(textureId) glDeleteTextures(1, &textureId);
+    if(samplerId) glDeleteSamplers(1, &samplerId);
+    textureId = other.textureId;
+    samplerId = other.samplerId;
+    resolution = other.resolution;
+    levels = other.levels;
+    validMask = other.validMask;
+    other.textureId = 0;
+    other.samplerId = 0;
+    return *this;
+}
+
+inline ShadowMomentsGL::~ShadowMomentsGL()
+{
+    if(textureId) glDeleteTextures(1, &textureId);
+    if(samplerId) glDeleteSamplers(1, &samplerId);
+}
+
+// Analytic shadows
+//
+// Every caster in the scene is a sphere, lit shaders compute the visible
+// fraction of the Sun's disk from each fragment against these spheres
+// (umbra, penumbra and annular eclipses) without a shadow map.
+struct SphereOccludersGL
+{
+    // These must match "debug.frag"
+    static constexpr uint32_t   MAX_OCCLUDERS   = 8;
+    static constexpr GLuint     UBO_OCCLUDERS   = 1;
+
+    // std140 layout of the "SphereOccluders" uniform block
+    struct Data
+    {
+        std::array<glm::vec4, MAX_OCCLUDERS> spheres;   // xyz: center, w: radius
+        glm::vec4   sun;                                // xyz: center, w: radius
+        uint32_t    count;
+        uint32_t    pad[3];
+    };
+    static_assert(sizeof(Data) == MAX_OCCLUDERS * 16 + 32, "Data must match std140 layout!");
+
+    GLuint      uBufferId   = 0;
+    Data        data        = {};
+
+    // Constructors, Movement & Destructor
+                        SphereOccludersGL();
+                        SphereOccludersGL(const SphereOccludersGL&) = delete;
+                        SphereOccludersGL(SphereOccludersGL&&);
+    SphereOccludersGL&  operator=(const SphereOccludersGL&) = delete;
+    SphereOccludersGL&  operator=(SphereOccludersGL&&);
+                        ~SphereOccludersGL();
+
+    // Spheres are given by the model matrices of the unit sphere meshes
+    // (uniform scale is the radius)
+    void    Clear();
+    void    AddOccluder(const glm::mat4& model);
+    void    SetSun(const glm::mat4& model);
+    void    Upload() const;
+    void    Bind() const;
+};
+
+inline SphereOccludersGL::SphereOccludersGL(SphereOccludersGL&& other)
+    : uBufferId(other.uBufferId)
+    , data(other.data)
+{
+    other.uBufferId = 0;
+}
+
+inline SphereOccludersGL& SphereOccludersGL::operator=(SphereOccludersGL&& other)
+{
+    assert(this != &other);
+    if(uBufferId) glDeleteBuffers(1, &uBufferId);
+    uBufferId = other.uBufferId;
+    data = other.data;
+    other.uBufferId = 0;
+    return *this;
+}
+
+inline SphereOccludersGL::~SphereOccludersGL()
+{
+    if(uBufferId) glDeleteBuffers(1, &uBufferId);
+}
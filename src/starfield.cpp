@@ -0,0 +1,244 @@
+#include "starfield.h"
+
+#include <stb_image.h>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+
+struct StarCatalogHeader
+{
+    static constexpr uint32_t MAGIC = 0x52415453; // "STAR"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t starCount;
+    uint32_t glowWidth;
+    uint32_t glowHeight;
+};
+
+float Luminance(const uint8_t* rgb)
+{
+    return 0.2126f * float(rgb[0]) + 0.7152f * float(rgb[1]) + 0.0722f * float(rgb[2]);
+}
+
+// Inverse of the sphere mesh UV mapping
+// (u = atan(z, -x) / 2pi + 0.5, v = asin(y) / pi + 0.5)
+glm::vec3 EquirectDirection(float u, float v)
+{
+    float lon = (u - 0.5f) * glm::two_pi<float>();
+    float lat = (v - 0.5f) * glm::pi<float>();
+    return glm::vec3(-std::cos(lat) * std::cos(lon),
+                     std::sin(lat),
+                     std::cos(lat) * std::sin(lon));
+}
+
+}
+
+StarCatalog GenerateStarCatalog(const std::string& skyImagePath, int glowWidth)
+{
+    static constexpr float DETECT_THRESHOLD = 24.0f;    //abc Luminance above the background to be a star
+    static constexpr size_t MAX_STARS = 200000;         //abc Faintest ones are dropped
+
+    int width = 0, height = 0, channelCount = 0;
+    uint8_t* pixels = stbi_load(skyImagePath.c_str(), &width, &height, &channelCount, 3);
+    if(!pixels)
+    {
+        std::fprintf(stderr, "Unable to read image \"%s\"\n", skyImagePath.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    int block = width / glowWidth;
+    if(block < 1 || width % glowWidth != 0 || height % block != 0)
+    {
+        stbi_image_free(pixels);
+        std::fprintf(stderr, "Glow width %d does not divide \"%s\" (%dx%d)!\n",
+                     glowWidth, skyImagePath.c_str(), width, height);
+        std::exit(EXIT_FAILURE);
+    }
+    auto Pixel = [&](int x, int y)
+    {
+        return pixels + (size_t(y) * size_t(width) + size_t(x)) * 3;
+    };
+
+    StarCatalog catalog;
+    catalog.glowWidth = glowWidth;
+    catalog.glowHeight = height / block;
+    catalog.glow.resize(size_t(catalog.glowWidth) * size_t(catalog.glowHeight) * 4);
+
+    // Glow is the median pixel of each block, isolated stars
+    // cover a small portion of it so they do not shift the median.
+    // Image rows are top-down, glow rows are bottom-up (like "TextureGL").
+    std::vector<std::pair<float, const uint8_t*>> blockPixels(size_t(block) * size_t(block));
+    for(int by = 0; by < catalog.glowHeight; by++)
+    for(int bx = 0; bx < catalog.glowWidth; bx++)
+    {
+        for(int y = 0; y < block; y++)
+        for(int x = 0; x < block; x++)
+        {
+            const uint8_t* p = Pixel(bx * block + x, by * block + y);
+            blockPixels[size_t(y * block + x)] = {Luminance(p), p};
+        }
+        auto median = blockPixels.begin() + std::ptrdiff_t(blockPixels.size() / 2);
+        std::nth_element(blockPixels.begin(), median, blockPixels.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        int row = catalog.glowHeight - 1 - by;
+        uint8_t* g = catalog.glow.data() + (size_t(row) * size_t(catalog.glowWidth) + size_t(bx)) * 4;
+        g[0] = median->second[0];
+        g[1] = median->second[1];
+        g[2] = median->second[2];
+        g[3] = 255;
+    }
+    auto Background = [&](int x, int y)
+    {
+        int row = catalog.glowHeight - 1 - y / block;
+        return catalog.glow.data() + (size_t(row) * size_t(catalog.glowWidth) + size_t(x / block)) * 4;
+    };
+
+    // Stars are the local maxima (ties go to the first pixel) above the background,
+    // flux is the excess luminance of the 3x3 neighbourhood
+    struct Detection { float flux; glm::vec3 direction; glm::vec3 color; };
+    std::vector<Detection> detections;
+    for(int y = 1; y < height - 1; y++)
+    for(int x = 0; x < width; x++)
+    {
+        const uint8_t* bg = Background(x, y);
+        float bgLum = Luminance(bg);
+        float lum = Luminance(Pixel(x, y));
+        if(lum - bgLum < DETECT_THRESHOLD) continue;
+
+        bool isPeak = true;
+        float flux = 0.0f;
+        for(int dy = -1; dy <= 1 && isPeak; dy++)
+        for(int dx = -1; dx <= 1 && isPeak; dx++)
+        {
+            if(dx == 0 && dy == 0) continue;
+            // Horizontal neighbours wrap around
+            float n = Luminance(Pixel((x + dx + width) % width, y + dy));
+            bool before = (dy < 0 || (dy == 0 && dx < 0));
+            isPeak = before ? (lum > n) : (lum >= n);
+            flux += std::max(n - bgLum, 0.0f);
+        }
+        if(!isPeak) continue;
+        flux += lum - bgLum;
+
+        const uint8_t* p = Pixel(x, y);
+        glm::vec3 color = glm::max(glm::vec3(p[0], p[1], p[2]) -
+                                   glm::vec3(bg[0], bg[1], bg[2]), glm::vec3(0.0f));
+        float u = (float(x) + 0.5f) / float(width);
+        float v = 1.0f - (float(y) + 0.5f) / float(height);
+        detections.push_back(Detection
+        {
+            .flux       = flux,
+            .direction  = EquirectDirection(u, v),
+            .color      = color / std::max({color.r, color.g, color.b, 1.0f})
+        });
+    }
+    stbi_image_free(pixels);
+
+    std::sort(detections.begin(), detections.end(),
+              [](const Detection& a, const Detection& b) { return a.flux > b.flux; });
+    if(detections.size() > MAX_STARS) detections.resize(MAX_STARS);
+
+    catalog.stars.reserve(detections.size());
+    float refFlux = detections.empty() ? 1.0f : detections.front().flux;
+    for(const Detection& d : detections)
+    {
+        float magnitude = -2.5f * std::log10(d.flux / refFlux);
+        uint32_t m = uint32_t(std::clamp(std::round(magnitude * 10.0f), 0.0f, 255.0f));
+        glm::uvec3 c = glm::uvec3(glm::round(d.color * 255.0f));
+        catalog.stars.push_back(Star
+        {
+            .direction  = d.direction,
+            .color      = c.r | (c.g << 8) | (c.b << 16) | (m << 24)
+        });
+    }
+    std::printf("Star catalog of %zu stars is generated from \"%s\".\n",
+                catalog.stars.size(), skyImagePath.c_str());
+    return catalog;
+}
+
+bool LoadStarCatalog(StarCatalog& catalog, const std::string& path)
+{
+    static constexpr uint32_t MAX_GLOW_SIZE = 16384;
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) return false;
+    uint64_t fileSize = uint64_t(file.tellg());
+    file.seekg(0);
+
+    StarCatalogHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(StarCatalogHeader));
+    if(!file ||
+       header.magic != StarCatalogHeader::MAGIC ||
+       header.version != StarCatalogHeader::VERSION ||
+       header.glowWidth == 0 || header.glowHeight == 0 ||
+       header.glowWidth > MAX_GLOW_SIZE || header.glowHeight > MAX_GLOW_SIZE)
+        return false;
+    // Sizes are checked before allocating, a corrupt file is regenerated
+    uint64_t expectedSize = sizeof(StarCatalogHeader) +
+                            uint64_t(header.starCount) * sizeof(Star) +
+                            uint64_t(header.glowWidth) * header.glowHeight * 4;
+    if(expectedSize != fileSize)
+        return false;
+
+    catalog.stars.resize(header.starCount);
+    catalog.glowWidth = int(header.glowWidth);
+    catalog.glowHeight = int(header.glowHeight);
+    catalog.glow.resize(size_t(header.glowWidth) * size_t(header.glowHeight) * 4);
+    file.read(reinterpret_cast<char*>(catalog.stars.data()),
+              std::streamsize(catalog.stars.size() * sizeof(Star)));
+    file.read(reinterpret_cast<char*>(catalog.glow.data()),
+              std::streamsize(catalog.glow.size()));
+    return bool(file);
+}
+
+void SaveStarCatalog(const StarCatalog& catalog, const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    StarCatalogHeader header =
+    {
+        .magic      = StarCatalogHeader::MAGIC,
+        .version    = StarCatalogHeader::VERSION,
+        .starCount  = uint32_t(catalog.stars.size()),
+        .glowWidth  = uint32_t(catalog.glowWidth),
+        .glowHeight = uint32_t(catalog.glowHeight)
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(StarCatalogHeader));
+    file.write(reinterpret_cast<const char*>(catalog.stars.data()),
+               std::streamsize(catalog.stars.size() * sizeof(Star)));
+    file.write(reinterpret_cast<const char*>(catalog.glow.data()),
+               std::streamsize(catalog.glow.size()));
+    if(!file)
+        std::printf("[WARNING]: Unable to write star catalog \"%s\".\n", path.c_str());
+}
+
+StarFieldGL::StarFieldGL(const StarCatalog& catalog)
+    : starCount(uint32_t(catalog.stars.size()))
+    , glow(catalog.glow.data(), catalog.glowWidth, catalog.glowHeight)
+{
+    glGenBuffers(1, &sBufferId);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sBufferId);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+                    GLsizeiptr(std::max<size_t>(catalog.stars.size(), 1) * sizeof(Star)),
+                    catalog.stars.empty() ? nullptr : catalog.stars.data(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    size_t glowBytes = size_t(glow.faceSize) * size_t(glow.faceSize) * 4 * 6;
+    std::printf("Star field of %u stars (%zu KiB) with %dx%d glow (%zu KiB) is created.\n",
+                starCount, size_t(starCount) * sizeof(Star) / 1024,
+                glow.faceSize, glow.faceSize, glowBytes / 1024);
+}
+
+void StarFieldGL::Draw() const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_STARS, sBufferId);
+    glDrawArrays(GL_POINTS, 0, GLsizei(starCount));
+}
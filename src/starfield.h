@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "utility.h"
+
+// Star catalog sky
+//
+// Alternative to the sky cubemap: individual stars are drawn as point
+// sprites (sized in pixels, so they stay sharp at any FOV) and only the
+// diffuse Milky Way glow comes from a small cubemap.
+//
+// Catalog is generated once from the equirectangular sky image; stars are
+// the local maxima above the local background, the glow is the background
+// itself (median of each block, so the stars are not smeared into it).
+
+// Per-instance data of the star sprites.
+// Layout must match "Star" (std430) at "stars.vert".
+struct Star
+{
+    glm::vec3   direction;  // Unit vector, mapped like the sphere mesh UVs
+    uint32_t    color;      // RGB8 peak color (max channel is 255), A8 is magnitude * 10
+};
+static_assert(sizeof(Star) == 16, "Star must match std430 layout!");
+
+struct StarCatalog
+{
+    std::vector<Star>       stars;      // Brightest first, magnitude 0 is the brightest
+    int                     glowWidth   = 0;
+    int                     glowHeight  = 0;
+    std::vector<uint8_t>    glow;       // RGBA8, equirectangular
+};
+
+// Extracts the catalog from an equirectangular image,
+// glow is "glowWidth" wide (source width must be a multiple of it)
+StarCatalog GenerateStarCatalog(const std::string& skyImagePath, int glowWidth);
+// Returns false if the file is missing or not a valid catalog
+bool        LoadStarCatalog(StarCatalog& catalog, const std::string& path);
+void        SaveStarCatalog(const StarCatalog& catalog, const std::string& path);
+
+struct StarFieldGL
+{
+    // This must match the SSBO binding at "stars.vert"
+    static constexpr GLuint SSBO_STARS = 0;
+
+    GLuint      sBufferId   = 0;
+    uint32_t    starCount   = 0;
+    CubemapGL   glow;
+    // Constructors, Movement & Destructor
+                    StarFieldGL(const StarCatalog&);
+                    StarFieldGL(const StarFieldGL&) = delete;
+                    StarFieldGL(StarFieldGL&&);
+    StarFieldGL&    operator=(const StarFieldGL&) = delete;
+    StarFieldGL&    operator=(StarFieldGL&&);
+                    ~StarFieldGL();
+
+    // One point per star, vertices are pulled from the SSBO
+    // (an attribute-less VAO must be bound)
+    void    Draw() const;
+};
+
+inline StarFieldGL::StarFieldGL(StarFieldGL&& other)
+    : sBufferId(other.sBufferId)
+    , starCount(other.starCount)
+    , glow(std::move(other.glow))
+{
+    other.sBufferId = 0;
+}
+
+inline StarFieldGL& StarFieldGL::operator=(StarFieldGL&& other)
+{
+    assert(this != &other);
+    if(sBufferId) glDeleteBuffers(1, &sBufferId);
+    sBufferId = other.sBufferId;
+    starCount = other.starCount;
+    glow = std::move(other.glow);
+    other.sBufferId = 0;
+    return *this;
+}
+
+inline StarFieldGL::~StarFieldGL()
+{
+    if(sBufferId) glDeleteBuffers(1, &sBufferId);
+}
@@ -0,0 +1,622 @@
+#include "terrain.h"
+
+#include <stb_image.h>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+
+struct TerrainTileHeader
+{
+    static constexpr uint32_t MAGIC = 0x454C4954; // "TILE"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t tileSize;
+    uint32_t pad;
+};
+
+// Face order & orientation of GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+// (same as "equirect_cube.comp"), face coordinates are warped to equal
+// angles so the cells do not shrink towards the face corners.
+// This must match "CubeToSphere" at "terrain.vert".
+glm::vec3 CubeToSphere(uint32_t face, glm::vec2 st)
+{
+    st = glm::tan(st * glm::quarter_pi<float>());
+    glm::vec3 p;
+    switch(face)
+    {
+        case 0:  p = glm::vec3( 1.0f,  -st.y, -st.x); break;
+        case 1:  p = glm::vec3(-1.0f,  -st.y,  st.x); break;
+        case 2:  p = glm::vec3( st.x,  1.0f,   st.y); break;
+        case 3:  p = glm::vec3( st.x, -1.0f,  -st.y); break;
+        case 4:  p = glm::vec3( st.x, -st.y,  1.0f);  break;
+        default: p = glm::vec3(-st.x, -st.y, -1.0f);  break;
+    }
+    return glm::normalize(p);
+}
+
+float Hash(int32_t x, int32_t y, int32_t z)
+{
+    uint32_t h = (uint32_t(x) * 0x8DA6B343u) ^ (uint32_t(y) * 0xD8163841u) ^ (uint32_t(z) * 0xCB1AB31Fu);
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return float(h >> 8) * (1.0f / 16777216.0f);
+}
+
+// [0, 1], quintic interpolation of the lattice values
+float ValueNoise(const glm::vec3& p)
+{
+    glm::vec3 cell = glm::floor(p);
+    glm::vec3 f = p - cell;
+    glm::vec3 u = f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
+    int32_t x = int32_t(cell.x), y = int32_t(cell.y), z = int32_t(cell.z);
+
+    float x00 = glm::mix(Hash(x, y,     z),     Hash(x + 1, y,     z),     u.x);
+    float x10 = glm::mix(Hash(x, y + 1, z),     Hash(x + 1, y + 1, z),     u.x);
+    float x01 = glm::mix(Hash(x, y,     z + 1), Hash(x + 1, y,     z + 1), u.x);
+    float x11 = glm::mix(Hash(x, y + 1, z + 1), Hash(x + 1, y + 1, z + 1), u.x);
+    return glm::mix(glm::mix(x00, x10, u.y), glm::mix(x01, x11, u.y), u.z);
+}
+
+float NodeArc(uint32_t level)
+{
+    return glm::half_pi<float>() / float(1u << level);
+}
+
+// Nodes of this level are split within this distance
+float NodeRange(uint32_t level)
+{
+    return TerrainGL::RANGE_FACTOR * NodeArc(level);
+}
+
+// Bounds the node at any height (corners are the farthest points)
+glm::vec4 NodeSphere(const TerrainKey& node)
+{
+    glm::vec2 origin = node.Origin();
+    float size = node.Size();
+    glm::vec3 center = CubeToSphere(node.face, origin + size * 0.5f) *
+                       (1.0f + TerrainGL::HEIGHT_SCALE * 0.5f);
+    float radius = 0.0f;
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        glm::vec3 dir = CubeToSphere(node.face, origin + glm::vec2(i & 1, i >> 1) * size);
+        radius = std::max({radius, glm::distance(center, dir),
+                           glm::distance(center, dir * (1.0f + TerrainGL::HEIGHT_SCALE))});
+    }
+    return glm::vec4(center, radius);
+}
+
+}
+
+uint64_t TerrainKey::Pack() const
+{
+    return (uint64_t(face) << 61) | (uint64_t(level) << 56) |
+           (uint64_t(x) << 28) | uint64_t(y);
+}
+
+TerrainKey TerrainKey::Unpack(uint64_t key)
+{
+    return TerrainKey
+    {
+        .face   = uint32_t(key >> 61),
+        .level  = uint32_t(key >> 56) & 0x1Fu,
+        .x      = uint32_t(key >> 28) & 0xFFFFFFFu,
+        .y      = uint32_t(key) & 0xFFFFFFFu
+    };
+}
+
+TerrainKey TerrainKey::Child(uint32_t i) const
+{
+    return TerrainKey
+    {
+        .face   = face,
+        .level  = level + 1,
+        .x      = x * 2 + (i & 1),
+        .y      = y * 2 + (i >> 1)
+    };
+}
+
+glm::vec2 TerrainKey::Origin() const
+{
+    return glm::vec2(x, y) * Size() - 1.0f;
+}
+
+float TerrainKey::Size() const
+{
+    return 2.0f / float(1u << level);
+}
+
+TerrainGL::TerrainGL(const std::string& oceanMaskPath, uint32_t workerCount)
+{
+    int channelCount = 0;
+    uint8_t* pixels = stbi_load(oceanMaskPath.c_str(), &maskWidth, &maskHeight, &channelCount, 1);
+    if(!pixels)
+    {
+        std::fprintf(stderr, "Unable to read image \"%s\"\n", oceanMaskPath.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    oceanMask.assign(pixels, pixels + size_t(maskWidth) * size_t(maskHeight));
+    stbi_image_free(pixels);
+
+    // Tiles of a body are in their own directory, keyed by everything that
+    // changes the generated texels (mask file identity & the constants)
+    if(!cacheDir.empty())
+    {
+        std::error_code err;
+        uint64_t key = HashFNV1a(oceanMaskPath);
+        key = HashFNV1a(std::to_string(std::filesystem::file_size(oceanMaskPath, err)), key);
+        auto writeTime = std::filesystem::last_write_time(oceanMaskPath, err);
+        key = HashFNV1a(std::to_string(writeTime.time_since_epoch().count()), key);
+        key = HashFNV1a(std::to_string(TerrainTileHeader::VERSION), key);
+        key = HashFNV1a(std::to_string(TILE_SIZE) + "/" + std::to_string(HEIGHT_SCALE), key);
+
+        char name[24];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+        tileDir = cacheDir + "/" + name;
+        std::filesystem::create_directories(tileDir, err);
+        if(err)
+        {
+            std::printf("[WARNING]: Unable to create terrain cache \"%s\", tiles are not saved.\n",
+                        tileDir.c_str());
+            tileDir.clear();
+        }
+    }
+
+    glGenTextures(1, &tileArrayId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tileArrayId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA16F,
+                   GLsizei(TILE_SIZE), GLsizei(TILE_SIZE), GLsizei(CACHE_TILES));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Roots are loaded up front & never evicted (first six layers)
+    layerKeys.assign(CACHE_TILES, 0);
+    layerLastUsed.assign(CACHE_TILES, 0);
+    for(uint32_t layer = CACHE_TILES; layer-- > 6;)
+        freeLayers.push_back(layer);
+    for(uint32_t face = 0; face < 6; face++)
+    {
+        uint64_t key = TerrainKey{face, 0, 0, 0}.Pack();
+        Upload(LoadOrGenerate(key), face);
+        resident.emplace(key, face);
+        layerKeys[face] = key;
+    }
+
+    glGenBuffers(1, &sBufferId);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sBufferId);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(MAX_CHUNKS * sizeof(TerrainChunk)),
+                    nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    chunks.reserve(MAX_CHUNKS);
+
+    // Grid vertices are (x, y, skirt), displacement is done by "terrain.vert"
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    for(uint32_t y = 0; y <= GRID; y++)
+    for(uint32_t x = 0; x <= GRID; x++)
+        vertices.emplace_back(x, y, 0.0f);
+    for(uint32_t y = 0; y < GRID; y++)
+    for(uint32_t x = 0; x < GRID; x++)
+    {
+        uint32_t v0 = y * TILE_SIZE + x;
+        uint32_t v1 = v0 + 1;
+        uint32_t v2 = v0 + TILE_SIZE;
+        uint32_t v3 = v2 + 1;
+        indices.insert(indices.end(), {v0, v1, v3,  v0, v3, v2});
+    }
+    // Skirts hang from the border, it is walked around as a closed loop
+    std::vector<uint32_t> border;
+    for(uint32_t x = 0; x < GRID; x++)     border.push_back(x);
+    for(uint32_t y = 0; y < GRID; y++)     border.push_back(y * TILE_SIZE + GRID);
+    for(uint32_t x = GRID; x > 0; x--)     border.push_back(GRID * TILE_SIZE + x);
+    for(uint32_t y = GRID; y > 0; y--)     border.push_back(y * TILE_SIZE);
+    uint32_t firstSkirt = uint32_t(vertices.size());
+    for(uint32_t b : border)
+        vertices.emplace_back(vertices[b].x, vertices[b].y, 1.0f);
+    for(uint32_t i = 0; i < border.size(); i++)
+    {
+        uint32_t next = (i + 1) % uint32_t(border.size());
+        uint32_t a = border[i], b = border[next];
+        uint32_t sa = firstSkirt + i, sb = firstSkirt + next;
+        indices.insert(indices.end(), {a, sa, b,  b, sa, sb});
+    }
+    indexCount = GLsizei(indices.size());
+
+    glGenBuffers(1, &vBufferId);
+    glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+    glBufferStorage(GL_ARRAY_BUFFER, GLsizeiptr(vertices.size() * sizeof(glm::vec3)),
+                    vertices.data(), 0);
+    glGenBuffers(1, &iBufferId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indices.size() * sizeof(uint32_t)),
+                    indices.data(), 0);
+
+    glGenVertexArrays(1, &vaoId);
+    glBindVertexArray(vaoId);
+    glBindVertexBuffer(0, vBufferId, 0, GLsizei(sizeof(glm::vec3)));
+    glEnableVertexAttribArray(MeshGL::IN_POS);
+    glVertexAttribFormat(MeshGL::IN_POS, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexAttribBinding(MeshGL::IN_POS, 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    workerCount = std::max(workerCount, 1u);
+    for(uint32_t i = 0; i < workerCount; i++)
+        workers.emplace_back([this]() { WorkerLoop(); });
+
+    size_t cacheBytes = size_t(TILE_SIZE) * size_t(TILE_SIZE) * 8 * CACHE_TILES;
+    std::printf("Terrain of \"%s\" is created (%u tiles, %zu KiB, %u workers).\n",
+                oceanMaskPath.c_str(), CACHE_TILES, cacheBytes / 1024, workerCount);
+}
+
+TerrainGL::~TerrainGL()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for(std::thread& w : workers) w.join();
+
+    if(vaoId) glDeleteVertexArrays(1, &vaoId);
+    if(vBufferId) glDeleteBuffers(1, &vBufferId);
+    if(iBufferId) glDeleteBuffers(1, &iBufferId);
+    if(sBufferId) glDeleteBuffers(1, &sBufferId);
+    if(tileArrayId) glDeleteTextures(1, &tileArrayId);
+}
+
+float TerrainGL::Height(const glm::vec3& dir) const
+{
+    static constexpr uint32_t OCTAVES = 14;         //abc Finest features are below the deepest grid
+    static constexpr float BASE_FREQUENCY = 3.0f;   //abc
+
+    // Land mask, bilinear at the sphere mesh UVs
+    // (u = atan(z, -x) / 2pi + 0.5, v = asin(y) / pi + 0.5, image rows are top-down)
+    float u = std::atan2(dir.z, -dir.x) / glm::two_pi<float>() + 0.5f;
+    float v = std::asin(glm::clamp(dir.y, -1.0f, 1.0f)) / glm::pi<float>() + 0.5f;
+    float px = u * float(maskWidth) - 0.5f;
+    float py = (1.0f - v) * float(maskHeight) - 0.5f;
+    int x0 = int(std::floor(px)), y0 = int(std::floor(py));
+    float fx = px - float(x0), fy = py - float(y0);
+    auto Water = [&](int x, int y)
+    {
+        x = (x % maskWidth + maskWidth) % maskWidth;
+        y = std::clamp(y, 0, maskHeight - 1);
+        return float(oceanMask[size_t(y) * size_t(maskWidth) + size_t(x)]) / 255.0f;
+    };
+    float water = glm::mix(glm::mix(Water(x0, y0),     Water(x0 + 1, y0),     fx),
+                           glm::mix(Water(x0, y0 + 1), Water(x0 + 1, y0 + 1), fx), fy);
+    float land = glm::smoothstep(0.2f, 0.8f, 1.0f - water);
+    if(land <= 0.0f) return 0.0f;
+
+    // Ridged fBm, octaves are offset so their lattices do not line up
+    float height = 0.0f;
+    float amplitude = 0.5f;
+    float frequency = BASE_FREQUENCY;
+    for(uint32_t i = 0; i < OCTAVES; i++)
+    {
+        float ridge = 1.0f - std::abs(ValueNoise(dir * frequency + float(i) * 17.31f) * 2.0f - 1.0f);
+        height += ridge * ridge * amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return land * std::min(height, 1.0f);
+}
+
+TerrainGL::Tile TerrainGL::Generate(uint64_t key) const
+{
+    TerrainKey node = TerrainKey::Unpack(key);
+    glm::vec2 origin = node.Origin();
+    float size = node.Size();
+
+    // One texel apron for the central differences of the normals
+    // (it is outside of the face for the border nodes, the warp extends)
+    static constexpr uint32_t N = TILE_SIZE + 2;
+    std::vector<glm::vec3> positions(N * N);
+    std::vector<float> heights(N * N);
+    for(uint32_t y = 0; y < N; y++)
+    for(uint32_t x = 0; x < N; x++)
+    {
+        glm::vec2 st = origin + (glm::vec2(x, y) - 1.0f) / float(GRID) * size;
+        glm::vec3 dir = CubeToSphere(node.face, st);
+        float h = Height(dir);
+        heights[y * N + x] = h;
+        positions[y * N + x] = dir * (1.0f + h * HEIGHT_SCALE);
+    }
+
+    Tile tile = {key, std::vector<uint16_t>(size_t(TILE_SIZE) * TILE_SIZE * 4)};
+    for(uint32_t y = 0; y < TILE_SIZE; y++)
+    for(uint32_t x = 0; x < TILE_SIZE; x++)
+    {
+        uint32_t c = (y + 1) * N + (x + 1);
+        glm::vec3 n = glm::normalize(glm::cross(positions[c + 1] - positions[c - 1],
+                                                positions[c + N] - positions[c - N]));
+        // Faces are not all right handed
+        if(glm::dot(n, positions[c]) < 0.0f) n = -n;
+
+        uint16_t* t = tile.texels.data() + (size_t(y) * TILE_SIZE + x) * 4;
+        t[0] = glm::packHalf1x16(n.x);
+        t[1] = glm::packHalf1x16(n.y);
+        t[2] = glm::packHalf1x16(n.z);
+        t[3] = glm::packHalf1x16(heights[c]);
+    }
+    return tile;
+}
+
+TerrainGL::Tile TerrainGL::LoadOrGenerate(uint64_t key) const
+{
+    std::string path;
+    if(!tileDir.empty())
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.tile", static_cast<unsigned long long>(key));
+        path = tileDir + name;
+
+        // Tiles have a fixed size, a truncated file is regenerated
+        const uint64_t TileBytes = sizeof(TerrainTileHeader) + uint64_t(TILE_SIZE) * TILE_SIZE * 4 * sizeof(uint16_t);
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        bool complete = file && uint64_t(file.tellg()) == TileBytes;
+        file.seekg(0);
+        TerrainTileHeader header = {};
+        if(complete &&
+           file.read(reinterpret_cast<char*>(&header), sizeof(TerrainTileHeader)) &&
+           header.magic == TerrainTileHeader::MAGIC &&
+           header.version == TerrainTileHeader::VERSION &&
+           header.key == key && header.tileSize == TILE_SIZE)
+        {
+            Tile tile = {key, std::vector<uint16_t>(size_t(TILE_SIZE) * TILE_SIZE * 4)};
+            if(file.read(reinterpret_cast<char*>(tile.texels.data()),
+                         std::streamsize(tile.texels.size() * sizeof(uint16_t))))
+                return tile;
+        }
+    }
+
+    Tile tile = Generate(key);
+    if(!path.empty())
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        TerrainTileHeader header =
+        {
+            .magic      = TerrainTileHeader::MAGIC,
+            .version    = TerrainTileHeader::VERSION,
+            .key        = key,
+            .tileSize   = TILE_SIZE,
+            .pad        = 0
+        };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(TerrainTileHeader));
+        file.write(reinterpret_cast<const char*>(tile.texels.data()),
+                   std::streamsize(tile.texels.size() * sizeof(uint16_t)));
+        if(!file)
+            std::printf("[WARNING]: Unable to write terrain tile \"%s\".\n", path.c_str());
+    }
+    return tile;
+}
+
+void TerrainGL::WorkerLoop()
+{
+    while(true)
+    {
+        uint64_t key = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [this]() { return stopping || !requests.empty(); });
+            if(stopping) return;
+            key = requests.front();
+            requests.pop_front();
+            inFlight.push_back(key);
+        }
+
+        Tile tile = LoadOrGenerate(key);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        inFlight.erase(std::find(inFlight.begin(), inFlight.end(), key));
+        results.push_back(std::move(tile));
+    }
+}
+
+void TerrainGL::Request(const std::vector<uint64_t>& keys)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // Stale requests are dropped; loaded but not uploaded tiles count
+    // towards the limit so they can not pile up either
+    requests.clear();
+    size_t pending = std::min<size_t>(inFlight.size() + results.size(), MAX_REQUESTS);
+    size_t capacity = MAX_REQUESTS - pending;
+    for(uint64_t key : keys)
+    {
+        if(requests.size() >= capacity) break;
+        if(std::find(inFlight.begin(), inFlight.end(), key) != inFlight.end()) continue;
+        if(std::any_of(results.begin(), results.end(),
+                       [key](const Tile& t) { return t.key == key; })) continue;
+        requests.push_back(key);
+    }
+    if(!requests.empty()) wakeUp.notify_all();
+}
+
+void TerrainGL::Upload(const Tile& tile, uint32_t layer)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tileArrayId);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, GLint(layer),
+                    GLsizei(TILE_SIZE), GLsizei(TILE_SIZE), 1,
+                    GL_RGBA, GL_HALF_FLOAT, tile.texels.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TerrainGL::UploadResults()
+{
+    std::vector<Tile> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = std::min<size_t>(results.size(), MAX_UPLOADS);
+        ready.assign(std::make_move_iterator(results.begin()),
+                     std::make_move_iterator(results.begin() + std::ptrdiff_t(count)));
+        results.erase(results.begin(), results.begin() + std::ptrdiff_t(count));
+    }
+
+    for(const Tile& tile : ready)
+    {
+        if(resident.count(tile.key)) continue;
+
+        uint32_t layer = 0;
+        if(!freeLayers.empty())
+        {
+            layer = freeLayers.back();
+            freeLayers.pop_back();
+        }
+        else
+        {
+            // Least recently used, tiles of the last frame are kept
+            // (the new one is dropped instead, it is requested again)
+            layer = 6;
+            for(uint32_t l = 7; l < CACHE_TILES; l++)
+                if(layerLastUsed[l] < layerLastUsed[layer]) layer = l;
+            if(layerLastUsed[layer] + 1 >= frame) continue;
+            resident.erase(layerKeys[layer]);
+        }
+        Upload(tile, layer);
+        resident.emplace(tile.key, layer);
+        layerKeys[layer] = tile.key;
+        layerLastUsed[layer] = frame;
+    }
+}
+
+void TerrainGL::Update(const glm::vec3& cameraPos, const glm::mat4& model,
+                       const Frustum& frustum)
+{
+    frame++;
+    UploadResults();
+
+    struct Candidate
+    {
+        TerrainKey  node;
+        uint32_t    layer;
+        float       distance;   // To the bounding sphere
+    };
+    auto MakeCandidate = [&](const TerrainKey& node, uint32_t layer, Candidate& c)
+    {
+        glm::vec4 sphere = NodeSphere(node);
+        if(!frustum.Intersects(TransformSphere(sphere, model))) return false;
+        float distance = std::max(glm::distance(cameraPos, glm::vec3(sphere)) - sphere.w, 0.0f);
+        c = Candidate{node, layer, distance};
+        return true;
+    };
+
+    std::vector<Candidate> current, next;
+    std::vector<std::pair<float, uint64_t>> missing;
+    for(uint32_t face = 0; face < 6; face++)
+    {
+        Candidate c;
+        if(MakeCandidate(TerrainKey{face, 0, 0, 0}, face, c)) current.push_back(c);
+    }
+
+    // Breadth first, nearest nodes are split first when the budget runs out
+    chunks.clear();
+    for(uint32_t level = 0; !current.empty(); level++)
+    {
+        std::sort(current.begin(), current.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+        next.clear();
+        for(size_t i = 0; i < current.size(); i++)
+        {
+            const Candidate& c = current[i];
+            layerLastUsed[c.layer] = frame;
+
+            // Selected so far, if none of the remaining ones are split
+            size_t count = chunks.size() + next.size() + (current.size() - i);
+            bool split = (level < MAX_LEVEL && c.distance < NodeRange(level + 1) &&
+                          count + 3 <= MAX_CHUNKS);
+            if(split)
+            {
+                for(uint32_t k = 0; k < 4; k++)
+                {
+                    uint64_t key = c.node.Child(k).Pack();
+                    if(resident.count(key)) continue;
+                    missing.emplace_back(c.distance, key);
+                    split = false;
+                }
+            }
+            if(split)
+            {
+                for(uint32_t k = 0; k < 4; k++)
+                {
+                    TerrainKey child = c.node.Child(k);
+                    Candidate cc;
+                    if(MakeCandidate(child, resident.at(child.Pack()), cc)) next.push_back(cc);
+                }
+                continue;
+            }
+
+            float range = NodeRange(level);
+            chunks.push_back(TerrainChunk
+            {
+                .origin     = c.node.Origin(),
+                .size       = c.node.Size(),
+                .face       = c.node.face,
+                .morphStart = range * MORPH_START,
+                .morphEnd   = range,
+                .layer      = c.layer,
+                .skirtDepth = std::min(HEIGHT_SCALE, NodeArc(level) * 0.25f)
+            });
+        }
+        std::swap(current, next);
+    }
+    chunkCount = uint32_t(chunks.size());
+
+    std::sort(missing.begin(), missing.end());
+    std::vector<uint64_t> keys(missing.size());
+    std::transform(missing.begin(), missing.end(), keys.begin(),
+                   [](const auto& m) { return m.second; });
+    Request(keys);
+
+    if(chunkCount == 0) return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sBufferId);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    GLsizeiptr(chunkCount * sizeof(TerrainChunk)), chunks.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void TerrainGL::Draw() const
+{
+    if(chunkCount == 0) return;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CHUNKS, sBufferId);
+    glBindVertexArray(vaoId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr,
+                            GLsizei(chunkCount));
+    glBindVertexArray(0);
+}
+
+void TerrainGL::PrintSummaryIfChanged()
+{
+    size_t streaming = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        streaming = requests.size() + inFlight.size() + results.size();
+    }
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer),
+                  "%u chunks (%u triangles) | %zu/%u tiles resident, %zu streaming",
+                  chunkCount, chunkCount * uint32_t(indexCount) / 3,
+                  resident.size(), CACHE_TILES, streaming);
+    if(lastSummary == buffer) return;
+    lastSummary = buffer;
+    std::printf("[Terrain] %s\n", buffer);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utility.h"
+#include "culling.h"
+
+// Quadtree terrain of the planet surfaces (CDLOD)
+//
+// Each face of the cube-sphere is a quadtree, every selected node is an
+// instance of the same grid that is displaced by the height & normal tile
+// of that node. Nodes are split by their distance to the camera; before
+// a node is merged back, the odd vertices of its grid slide onto the even
+// ones (the grid of the parent), so the LOD switches do not pop. Skirts
+// hide the cracks while the neighbours are not at the expected levels.
+//
+// Tiles are streamed from "cacheDir" by worker threads (generated & saved
+// there on a miss) into a fixed array of GPU layers. A node is only split
+// when the tiles of its children are resident, it is drawn until then.
+// Chunks, GPU tiles and the queued requests are all capped, so the memory
+// & the triangle count do not depend on how close the camera gets.
+//
+// Everything here is in the object space of the body (unit sphere).
+
+// Node of the quadtree
+struct TerrainKey
+{
+    uint32_t face;
+    uint32_t level;
+    uint32_t x, y;      // [0, 2^level)
+
+    uint64_t            Pack() const;
+    static TerrainKey   Unpack(uint64_t);
+    TerrainKey          Child(uint32_t i) const;
+    // Area on the face, face coordinates are [-1, 1]
+    glm::vec2           Origin() const;
+    float               Size() const;
+};
+
+// Per-instance data of the terrain chunks.
+// Layout must match "TerrainChunk" (std430) at "terrain.vert".
+struct TerrainChunk
+{
+    glm::vec2   origin;
+    float       size;
+    uint32_t    face;
+    float       morphStart;     // Distance to the camera where the grid starts
+    float       morphEnd;       // to morph into the parent's grid (done at the end)
+    uint32_t    layer;          // Layer of the tile array
+    float       skirtDepth;
+};
+static_assert(sizeof(TerrainChunk) == 32, "TerrainChunk must match std430 layout!");
+
+struct TerrainGL
+{
+    static constexpr uint32_t GRID          = 32;           // Quads along a chunk edge
+    static constexpr uint32_t TILE_SIZE     = GRID + 1;     // Texels are at the grid vertices
+    static constexpr uint32_t MAX_LEVEL     = 10;           //abc Deepest level of the quadtree
+    static constexpr uint32_t MAX_CHUNKS    = 384;          //abc Triangle budget (chunks per frame)
+    static constexpr uint32_t CACHE_TILES   = 1024;         //abc GPU tile layers (fixed memory)
+    static constexpr uint32_t MAX_UPLOADS   = 8;            //abc Tiles uploaded per frame
+    static constexpr uint32_t MAX_REQUESTS  = 64;           //abc Queued tile requests
+    static constexpr float    RANGE_FACTOR  = 6.0f;         //abc Split distance over the node edge length
+    static constexpr float    MORPH_START   = 0.8f;         //abc Morph starts at this fraction of the range
+    // These must match "terrain.vert"
+    static constexpr GLuint   SSBO_CHUNKS   = 0;
+    static constexpr GLuint   T_TILES       = 6;
+    // Object space relief of the highest peaks
+    static constexpr float    HEIGHT_SCALE  = 0.004f;       //abc
+
+    // Generated tiles are written here (empty to regenerate them each time)
+    static inline std::string cacheDir = "terrain_cache";
+
+    GLuint      tileArrayId     = 0;    // RGBA16F, xyz: object space normal, w: height [0, 1]
+    GLuint      sBufferId       = 0;
+    GLuint      vBufferId       = 0;
+    GLuint      iBufferId       = 0;
+    GLuint      vaoId           = 0;
+    GLsizei     indexCount      = 0;
+    uint32_t    chunkCount      = 0;    // Selected by the last "Update"
+
+    // Constructors & Destructor
+    // Workers keep a pointer to this, so it does not move
+                TerrainGL(const std::string& oceanMaskPath, uint32_t workerCount);
+                TerrainGL(const TerrainGL&) = delete;
+                TerrainGL(TerrainGL&&) = delete;
+    TerrainGL&  operator=(const TerrainGL&) = delete;
+    TerrainGL&  operator=(TerrainGL&&) = delete;
+                ~TerrainGL();
+
+    // Uploads the streamed tiles, selects the chunks around "cameraPos"
+    // (object space) and requests the missing tiles of the nodes to be split.
+    // "model" & "frustum" cull the chunks in world space.
+    void        Update(const glm::vec3& cameraPos, const glm::mat4& model,
+                       const Frustum& frustum);
+    // Single instanced draw of the selected chunks
+    // (tile array must be bound to "T_TILES")
+    void        Draw() const;
+    void        PrintSummaryIfChanged();
+
+    private:
+    struct Tile
+    {
+        uint64_t                key;
+        std::vector<uint16_t>   texels;     // TILE_SIZE^2 RGBA16F
+    };
+
+    // Heights of the body
+    std::vector<uint8_t>    oceanMask;      // R8, equirectangular (255 is water)
+    int                     maskWidth       = 0;
+    int                     maskHeight      = 0;
+    std::string             tileDir;        // Empty if the cache is disabled
+
+    // Residency of the GPU tiles, roots are pinned to the first layers
+    std::unordered_map<uint64_t, uint32_t>  resident;
+    std::vector<uint64_t>                   layerKeys;
+    std::vector<uint64_t>                   layerLastUsed;
+    std::vector<uint32_t>                   freeLayers;
+    uint64_t                                frame = 0;
+    std::vector<TerrainChunk>               chunks;
+
+    // Streaming, guarded by "mutex"
+    std::mutex                  mutex;
+    std::condition_variable     wakeUp;
+    std::deque<uint64_t>        requests;
+    std::vector<uint64_t>       inFlight;
+    std::vector<Tile>           results;
+    bool                        stopping = false;
+    std::vector<std::thread>    workers;
+
+    std::string                 lastSummary;
+
+    float       Height(const glm::vec3& dir) const;
+    Tile        LoadOrGenerate(uint64_t key) const;
+    Tile        Generate(uint64_t key) const;
+    void        WorkerLoop();
+    void        UploadResults();
+    void        Upload(const Tile& tile, uint32_t layer);
+    // Replaces the queued requests (nearest first)
+    void        Request(const std::vector<uint64_t>& keys);
+};
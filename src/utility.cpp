@@ -4,15 +4,19 @@
 #include <GLFW/glfw3.h>
 #include <stb_image.h>
 #include <glm/glm.hpp>
+#include <glm/ext.hpp>
 
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <bit>
 #include <unordered_map>
 #include <fstream>
+#include <limits>
 #include <vector>
 #include <charconv>
 #include <array>
+#include <filesystem>
 
 void SetupGLFWErrorCallback();
 void SetupOpenGLErrorCallback();
@@ -55,7 +59,7 @@ GLState::GLState(const char* const windowName,
     glfwWindowHint(GLFW_DECORATED, GLFW_TRUE);
     // OGL Context
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5); // glClipControl
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
     // Set Debug Context for error reporting
     // Hopefully it will have minimal performance impact
@@ -112,32 +116,220 @@ GLState::GLState(const char* const windowName,
     std::printf("OpenGL : %s\n", glGetString(GL_VERSION));
     std::printf("GLSL   : %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
     std::printf("Device : %s\n", glGetString(GL_RENDERER));
+
+    // Parallel shader compilation (glad is generated without extensions)
+    using MaxCompilerThreadsFunc = void (APIENTRY*)(GLuint);
+    MaxCompilerThreadsFunc maxCompilerThreads = nullptr;
+    if(glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        maxCompilerThreads = reinterpret_cast<MaxCompilerThreadsFunc>
+            (glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+    else if(glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        maxCompilerThreads = reinterpret_cast<MaxCompilerThreadsFunc>
+            (glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+    if(maxCompilerThreads)
+    {
+        // Let the driver decide the thread count
+        maxCompilerThreads(0xFFFFFFFF);
+        ShaderGL::parallelCompile = true;
+    }
+    std::printf("Parallel Shader Compile : %s\n",
+                ShaderGL::parallelCompile ? "Yes" : "No");
     std::printf("\n");
 
     // Create shader pipeline
     glGenProgramPipelines(1, &renderPipeline);
     glBindProgramPipeline(renderPipeline);
+    glGenVertexArrays(1, &emptyVao);
+    glGenFramebuffers(1, &presentFbo);
 
     // All done! Happy rendering.
 
-    earthVec   = glm::vec3(0.0f);
-    moonVec    = glm::vec3(0.0f);
-    jupiterVec = glm::vec3(0.0f);
-    pos  = glm::vec3(0.0f, 2.0f, 6.0f); // Dünya izleme konumu
+    pos  = glm::dvec3(0.0, 2.0, 6.0); // Dünya izleme konumu
     gaze = glm::vec3(0.0f, 0.0f, 0.0f); // Merkeze bak
     up   = glm::vec3(0.0f, 1.0f, 0.0f); // Tavan yukarıda
-    mode = 0;
 }
 
 GLState::~GLState()
 {
     if(renderPipeline) glDeleteProgramPipelines(1, &renderPipeline);
+    if(emptyVao) glDeleteVertexArrays(1, &emptyVao);
+    if(presentFbo) glDeleteFramebuffers(1, &presentFbo);
     if(window) glfwDestroyWindow(window);
     glfwTerminate();
 }
 
-ShaderGL::ShaderGL(Type t, const std::string& path)
+// On-disk program binary cache
+// Binaries are keyed by the final source (with defines), the stage and
+// the driver identity. A binary that the driver rejects is deleted and
+// the program is compiled from source instead.
+struct ProgramBinaryHeader
+{
+    static constexpr uint32_t MAGIC = 0x4E494250; // "PBIN"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t size;
+};
+
+uint64_t HashFNV1a(std::string_view data, uint64_t hash)
+{
+    for(char c : data)
+    {
+        hash ^= uint64_t(uint8_t(c));
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+glm::mat4 PerspectiveReverseZ(float fovY, float aspect, float zNear)
+{
+    // Limit of glm::perspectiveZO as far goes to infinity, with z flipped
+    float f = 1.0f / std::tan(fovY * 0.5f);
+    glm::mat4 m = glm::mat4(0.0f);
+    m[0][0] = f / aspect;
+    m[1][1] = f;
+    m[2][3] = -1.0f;
+    m[3][2] = zNear;
+    return m;
+}
+
+glm::mat4 CameraRelative(const glm::dmat4& model, const glm::dvec3& origin)
+{
+    // Translation is subtracted before the precision is lost
+    glm::dmat4 relative = model;
+    relative[3] -= glm::dvec4(origin, 0.0);
+    return glm::mat4(relative);
+}
+
+const std::string& DriverIdentity()
+{
+    static const std::string Identity = []()
+    {
+        auto Str = [](GLenum e)
+        {
+            const GLubyte* s = glGetString(e);
+            return std::string(s ? reinterpret_cast<const char*>(s) : "");
+        };
+        return (Str(GL_VENDOR) + "|" + Str(GL_RENDERER) + "|" +
+                Str(GL_VERSION) + "|" + Str(GL_SHADING_LANGUAGE_VERSION));
+    }();
+    return Identity;
+}
+
+bool ProgramBinarySupported()
 {
+    static const bool Supported = []()
+    {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        return formatCount > 0;
+    }();
+    return Supported;
+}
+
+// Issues "glProgramBinary" for a valid cache file, link status
+// is queried later (it may complete asynchronously)
+GLuint IssueProgramBinary(const std::string& cachePath, uint64_t key)
+{
+    std::ifstream file(cachePath, std::ios::binary | std::ios::ate);
+    if(!file) return 0;
+    uint64_t fileSize = uint64_t(file.tellg());
+    file.seekg(0);
+
+    // Header is checked before anything is allocated, a truncated or
+    // corrupt file falls back to the compilation like a stale one
+    ProgramBinaryHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(ProgramBinaryHeader));
+    bool valid = (file &&
+                  header.magic == ProgramBinaryHeader::MAGIC &&
+                  header.version == ProgramBinaryHeader::VERSION &&
+                  header.key == key &&
+                  header.size > 0 &&
+                  header.size <= uint32_t(std::numeric_limits<GLsizei>::max()) &&
+                  header.size <= fileSize - sizeof(ProgramBinaryHeader));
+    std::vector<char> binary;
+    if(valid)
+    {
+        binary.resize(header.size);
+        file.read(binary.data(), std::streamsize(header.size));
+        valid = bool(file);
+    }
+    file.close();
+    if(!valid)
+    {
+        std::printf("[WARNING]: Program binary \"%s\" is stale, recompiling.\n",
+                    cachePath.c_str());
+        std::error_code err;
+        std::filesystem::remove(cachePath, err);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glProgramBinary(program, GLenum(header.format), binary.data(),
+                    GLsizei(header.size));
+    return program;
+}
+
+void SaveProgramBinary(GLuint program, const std::string& cachePath, uint64_t key)
+{
+    GLint binarySize = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if(binarySize <= 0) return;
+
+    std::vector<char> binary(size_t(binarySize), '\0');
+    GLenum format = 0;
+    glGetProgramBinary(program, binarySize, &binarySize, &format, binary.data());
+
+    std::error_code err;
+    std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), err);
+    std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+    ProgramBinaryHeader header =
+    {
+        .magic   = ProgramBinaryHeader::MAGIC,
+        .version = ProgramBinaryHeader::VERSION,
+        .key     = key,
+        .format  = uint32_t(format),
+        .size    = uint32_t(binarySize)
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(ProgramBinaryHeader));
+    file.write(binary.data(), binarySize);
+    if(!file)
+        std::printf("[WARNING]: Unable to write program binary \"%s\".\n",
+                    cachePath.c_str());
+}
+
+const char* ShaderTypeString(ShaderGL::Type t)
+{
+    switch(t)
+    {
+        case ShaderGL::VERTEX:          return "Vertex";
+        case ShaderGL::GEOMETRY:        return "Geometry";
+        case ShaderGL::FRAGMENT:        return "Fragment";
+        case ShaderGL::COMPUTE:         return "Compute";
+        case ShaderGL::TESS_CONTROL:    return "Tessellation Control";
+        case ShaderGL::TESS_EVALUATION: return "Tessellation Evaluation";
+        default:                        return "Unknown";
+    }
+}
+
+ShaderGL::ShaderGL(Type t, const std::string& filePath,
+                   const std::vector<std::string>& defines)
+    : type(t)
+    , path(filePath)
+{
+    if(t != ShaderGL::VERTEX && t != ShaderGL::GEOMETRY &&
+       t != ShaderGL::FRAGMENT && t != ShaderGL::COMPUTE &&
+       t != ShaderGL::TESS_CONTROL && t != ShaderGL::TESS_EVALUATION)
+    {
+        std::fprintf(stderr, "Unkown Shader Type while compiling \"%s\"!",
+                     path.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
     std::ifstream file(path, std::ios::binary);
     if(!file)
     {
@@ -145,86 +337,165 @@ ShaderGL::ShaderGL(Type t, const std::string& path)
                     path.c_str());
         std::exit(EXIT_FAILURE);
     }
-    GLint sourceSize = GLint(file.seekg(0, std::ios::end).tellg());
-    std::vector<GLchar> source(size_t(sourceSize + 1), '\0');
+    size_t sourceSize = size_t(file.seekg(0, std::ios::end).tellg());
+    std::string fileSource(sourceSize, '\0');
     file.seekg(0, std::ios::beg);
-    file.read(source.data(), sourceSize);
-
-    // Create temporary shader
-    GLuint shaderGL = glCreateShader(t);
-    GLchar* srcPtr = source.data();
-    glShaderSource(shaderGL, 1, &srcPtr, &sourceSize);
-    glCompileShader(shaderGL);
-    GLint isCompiled = GL_FALSE;
-    glGetShaderiv(shaderGL, GL_COMPILE_STATUS, &isCompiled);
-    if(isCompiled == GL_FALSE)
-    {
-        // We do not need to print the compilation error
-        // OpenGL debug callback will automatically handle it
-        std::fprintf(stderr, "Unable to compile shader \"%s\"\n",
-                     path.c_str());
+    file.read(fileSource.data(), GLsizei(sourceSize));
 
-        GLint errLen = 0;
-        glGetShaderiv(shaderGL, GL_INFO_LOG_LENGTH, &errLen);
-        std::vector<char> errLog(size_t(errLen + 1), '\0');
-        glGetShaderInfoLog(shaderGL, errLen, &errLen, errLog.data());
+    // Inject the defines right after the "#version" line
+    // (it must be the first statement of the source)
+    std::string_view sourceView = fileSource;
+    size_t versionEnd = 0;
+    if(sourceView.starts_with("#version"))
+        versionEnd = std::min(sourceView.find('\n'), sourceView.size());
+    std::string defineBlock;
+    for(const std::string& d : defines)
+    {
+        defineBlock += "#define " + d + "\n";
+        defineList += (defineList.empty() ? "" : ", ") + d;
+    }
+    if(!defineBlock.empty() && versionEnd != 0)
+        defineBlock += "#line 2\n";
 
-        // Use our own print here
-        PrintOpenGLError(GL_DEBUG_SOURCE_SHADER_COMPILER,
-                         GL_DEBUG_TYPE_ERROR, 0,
-                         GL_DEBUG_SEVERITY_HIGH,
-                         errLen, errLog.data(), nullptr);
+    source.reserve(sourceSize + defineBlock.size() + 1);
+    source += sourceView.substr(0, versionEnd);
+    source += "\n";
+    source += defineBlock;
+    source += sourceView.substr(versionEnd);
 
-        std::exit(EXIT_FAILURE);
+    // Try to skip the compilation via the program binary cache
+    if(!binaryCacheDir.empty() && ProgramBinarySupported())
+    {
+        cacheKey = HashFNV1a(DriverIdentity());
+        cacheKey = HashFNV1a(std::to_string(uint32_t(t)), cacheKey);
+        cacheKey = HashFNV1a(source, cacheKey);
+
+        std::array<char, 17> hex = {};
+        std::snprintf(hex.data(), hex.size(), "%016llx",
+                      static_cast<unsigned long long>(cacheKey));
+        cachePath = binaryCacheDir + "/" + hex.data() + ".bin";
+
+        shaderId = IssueProgramBinary(cachePath, cacheKey);
+        fromBinary = (shaderId != 0);
     }
+    if(!fromBinary) IssueCompile();
+}
+
+void ShaderGL::IssueCompile()
+{
+    // Only issue the commands, statuses are queried on "Finalize"
+    // so that the driver can compile multiple shaders concurrently.
+    stageId = glCreateShader(type);
+    const GLchar* srcPtr = source.c_str();
+    GLint srcSize = GLint(source.size());
+    glShaderSource(stageId, 1, &srcPtr, &srcSize);
+    glCompileShader(stageId);
 
     // Attach this to openGL "program"
     // (which represents entirity of the programmable rasterizer pipeline)
     shaderId = glCreateProgram();
     glProgramParameteri(shaderId, GL_PROGRAM_SEPARABLE, GL_TRUE);
-    glAttachShader(shaderId, shaderGL);
+    if(!cachePath.empty())
+        glProgramParameteri(shaderId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(shaderId, stageId);
     glLinkProgram(shaderId);
+}
+
+bool ShaderGL::Poll()
+{
+    if(status != PENDING) return true;
+
+    // Non-blocking check, without the extension the driver
+    // may still compile in the background; "Finalize" will wait for it.
+    if(parallelCompile)
+    {
+        GLint isDone = GL_FALSE;
+        glGetProgramiv(shaderId, COMPLETION_STATUS_KHR, &isDone);
+        if(isDone == GL_FALSE) return false;
+    }
+    Finalize();
+    return status != PENDING;
+}
+
+ShaderGL::Status ShaderGL::Wait()
+{
+    while(status == PENDING) Finalize();
+    return status;
+}
+
+void ShaderGL::Finalize()
+{
+    const char* shaderTypeStr = ShaderTypeString(type);
+
     GLint isLinked = GL_FALSE;
     glGetProgramiv(shaderId, GL_LINK_STATUS, &isLinked);
+    if(fromBinary)
+    {
+        fromBinary = false;
+        if(isLinked == GL_TRUE)
+        {
+            status = READY;
+            std::printf("%s Shader \"%s\" [%s] is loaded from the binary cache.\n",
+                        shaderTypeStr, path.c_str(), defineList.c_str());
+            return;
+        }
+        // Driver update, corrupted file etc. Remove it, it will be rewritten
+        std::printf("[WARNING]: Program binary \"%s\" is stale, recompiling.\n",
+                    cachePath.c_str());
+        std::error_code err;
+        std::filesystem::remove(cachePath, err);
+        glDeleteProgram(shaderId);
+        IssueCompile();
+        return;
+    }
+
     if(isLinked == GL_FALSE)
     {
-        // We do not need to print the compilation error
-        // OpenGL debug callback will automatically handle it
-        std::fprintf(stderr, "Unable to link shader \"%s\"\n",
-                     path.c_str());
+        GLint isCompiled = GL_FALSE;
+        glGetShaderiv(stageId, GL_COMPILE_STATUS, &isCompiled);
 
         GLint errLen = 0;
-        glGetProgramiv(shaderId, GL_INFO_LOG_LENGTH, &errLen);
-        std::vector<char> errLog(size_t(errLen + 1), '\0');
-        glGetProgramInfoLog(shaderId, errLen, &errLen, errLog.data());
+        std::vector<char> errLog;
+        if(isCompiled == GL_FALSE)
+        {
+            std::fprintf(stderr, "Unable to compile shader \"%s\" [%s]\n",
+                         path.c_str(), defineList.c_str());
+            glGetShaderiv(stageId, GL_INFO_LOG_LENGTH, &errLen);
+            errLog.resize(size_t(errLen + 1), '\0');
+            glGetShaderInfoLog(stageId, errLen, &errLen, errLog.data());
+        }
+        else
+        {
+            std::fprintf(stderr, "Unable to link shader \"%s\" [%s]\n",
+                         path.c_str(), defineList.c_str());
+            glGetProgramiv(shaderId, GL_INFO_LOG_LENGTH, &errLen);
+            errLog.resize(size_t(errLen + 1), '\0');
+            glGetProgramInfoLog(shaderId, errLen, &errLen, errLog.data());
+        }
         // Use our own print here
         PrintOpenGLError(GL_DEBUG_SOURCE_SHADER_COMPILER,
                          GL_DEBUG_TYPE_ERROR, 0,
                          GL_DEBUG_SEVERITY_HIGH,
                          errLen, errLog.data(), nullptr);
-        std::exit(EXIT_FAILURE);
+
+        glDeleteShader(stageId);
+        glDeleteProgram(shaderId);
+        stageId = 0;
+        shaderId = 0;
+        status = FAILED;
+        return;
     }
     // After linking, we can detach the shader.
     // Actual compiled assembly will be stayed inside the pipeline (program).
-    glDetachShader(shaderId, shaderGL);
-    glDeleteShader(shaderGL);
+    glDetachShader(shaderId, stageId);
+    glDeleteShader(stageId);
+    stageId = 0;
 
-    static const char* const VertexStr      = "Vertex";
-    static const char* const FragmentStr    = "Fragment";
-    const char* shaderTypeStr = nullptr;
-    switch(t)
-    {
-        case ShaderGL::VERTEX:      shaderTypeStr = VertexStr; break;
-        case ShaderGL::FRAGMENT:    shaderTypeStr = FragmentStr; break;
-        default:
-        {
-            std::fprintf(stderr, "Unkown Shader Type while compiling \"%s\"!",
-                         path.c_str());
-            std::exit(EXIT_FAILURE);
-        }
-    }
-    std::printf("%s Shader \"%s\" is compiled succesfully.\n",
-                shaderTypeStr, path.c_str());
+    if(!cachePath.empty()) SaveProgramBinary(shaderId, cachePath, cacheKey);
+
+    status = READY;
+    std::printf("%s Shader \"%s\" [%s] is compiled succesfully.\n",
+                shaderTypeStr, path.c_str(), defineList.c_str());
 }
 
 // For mesh multiple index hashing
@@ -411,6 +682,21 @@ MeshGL::MeshGL(const std::string& objPath)
             linNormals[i] = glm::vec3(0);
         }
     }
+    // Bounds (for culling), sphere is centered at the box
+    aabbMin = glm::vec3(std::numeric_limits<float>::max());
+    aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for(const glm::vec3& p : linPositions)
+    {
+        aabbMin = glm::min(aabbMin, p);
+        aabbMax = glm::max(aabbMax, p);
+    }
+    if(linPositions.empty()) aabbMin = aabbMax = glm::vec3(0.0f);
+    glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+    float radius = 0.0f;
+    for(const glm::vec3& p : linPositions)
+        radius = std::max(radius, glm::distance(p, center));
+    boundingSphere = glm::vec4(center, radius);
+
     // Delete tmp buffers
     positions = std::vector<glm::vec3>();
     normals = std::vector<glm::vec3>();
@@ -425,6 +711,41 @@ MeshGL::MeshGL(const std::string& objPath)
                     "uvs are not present. These are written as zero!\n",
                     objPath.c_str());
 
+    Upload(linPositions, linNormals, linUVs, indices);
+
+    std::printf("Obj file \"%s\" is loaded succesfully.\n",
+                objPath.c_str());
+}
+
+MeshGL::MeshGL(const std::vector<glm::vec3>& positions,
+               const std::vector<glm::vec3>& normals,
+               const std::vector<glm::vec2>& uvs,
+               const std::vector<uint32_t>& indices)
+{
+    assert(positions.size() == normals.size() && positions.size() == uvs.size());
+    Upload(positions, normals, uvs, indices);
+}
+
+void MeshGL::Upload(const std::vector<glm::vec3>& linPositions,
+                    const std::vector<glm::vec3>& linNormals,
+                    const std::vector<glm::vec2>& linUVs,
+                    const std::vector<uint32_t>& indices)
+{
+    // Bounds (for culling), sphere is centered at the box
+    aabbMin = glm::vec3(std::numeric_limits<float>::max());
+    aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for(const glm::vec3& p : linPositions)
+    {
+        aabbMin = glm::min(aabbMin, p);
+        aabbMax = glm::max(aabbMax, p);
+    }
+    if(linPositions.empty()) aabbMin = aabbMax = glm::vec3(0.0f);
+    glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+    float radius = 0.0f;
+    for(const glm::vec3& p : linPositions)
+        radius = std::max(radius, glm::distance(p, center));
+    boundingSphere = glm::vec4(center, radius);
+
     // ===================== //
     //   GEN BUFFER AND VAO  //
     // ===================== //
@@ -482,13 +803,65 @@ MeshGL::MeshGL(const std::string& objPath)
     // to make the vao to store indices so that we can call draw elements call
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
 
-    std::printf("Obj file \"%s\" is loaded succesfully.\n",
-                objPath.c_str());
-
     indexCount = uint32_t(indices.size());
     assert(indexCount % 3 == 0);
 }
 
+MeshGL GenerateIcosphere(uint32_t subdivisions)
+{
+    // Icosahedron, counter-clockwise from the outside
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    std::vector<glm::vec3> positions =
+    {
+        {-1,  t,  0}, { 1,  t,  0}, {-1, -t,  0}, { 1, -t,  0},
+        { 0, -1,  t}, { 0,  1,  t}, { 0, -1, -t}, { 0,  1, -t},
+        { t,  0, -1}, { t,  0,  1}, {-t,  0, -1}, {-t,  0,  1}
+    };
+    std::vector<uint32_t> indices =
+    {
+        0, 11,  5,   0,  5,  1,   0,  1,  7,   0,  7, 10,   0, 10, 11,
+        1,  5,  9,   5, 11,  4,  11, 10,  2,  10,  7,  6,   7,  1,  8,
+        3,  9,  4,   3,  4,  2,   3,  2,  6,   3,  6,  8,   3,  8,  9,
+        4,  9,  5,   2,  4, 11,   6,  2, 10,   8,  6,  7,   9,  8,  1
+    };
+    for(glm::vec3& p : positions) p = glm::normalize(p);
+
+    // Each triangle is split into four, shared midpoints are reused
+    for(uint32_t s = 0; s < subdivisions; s++)
+    {
+        std::unordered_map<uint64_t, uint32_t> midpoints;
+        auto Midpoint = [&](uint32_t a, uint32_t b)
+        {
+            uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+            auto [it, inserted] = midpoints.emplace(key, uint32_t(positions.size()));
+            if(inserted)
+                positions.push_back(glm::normalize(positions[a] + positions[b]));
+            return it->second;
+        };
+        std::vector<uint32_t> subdivided;
+        subdivided.reserve(indices.size() * 4);
+        for(size_t i = 0; i < indices.size(); i += 3)
+        {
+            uint32_t v0 = indices[i], v1 = indices[i + 1], v2 = indices[i + 2];
+            uint32_t m01 = Midpoint(v0, v1);
+            uint32_t m12 = Midpoint(v1, v2);
+            uint32_t m20 = Midpoint(v2, v0);
+            subdivided.insert(subdivided.end(), {v0, m01, m20,  v1, m12, m01,
+                                                 v2, m20, m12,  m01, m12, m20});
+        }
+        indices = std::move(subdivided);
+    }
+
+    // Unit sphere, UVs are the same mapping as the sphere meshes
+    // (they wrap at the seam, tessellated variants compute their own)
+    std::vector<glm::vec2> uvs;
+    uvs.reserve(positions.size());
+    for(const glm::vec3& p : positions)
+        uvs.emplace_back(std::atan2(p.z, -p.x) / (2.0f * glm::pi<float>()) + 0.5f,
+                         std::asin(glm::clamp(p.y, -1.0f, 1.0f)) / glm::pi<float>() + 0.5f);
+    return MeshGL(positions, positions, uvs, indices);
+}
+
 TextureGL::TextureGL(const std::string& texPath,
                      SampleMode sampleMode, EdgeResolve edgeResolveMode)
 {
@@ -558,6 +931,294 @@ TextureGL::TextureGL(const std::string& texPath,
     stbi_image_free(rawPixels);
 }
 
+TextureArrayGL::TextureArrayGL(const std::vector<std::string>& texPaths,
+                               int w, int h,
+                               TextureGL::EdgeResolve edgeResolveMode)
+    : width(w)
+    , height(h)
+    , layerCount(int(texPaths.size()))
+{
+    if(texPaths.empty())
+    {
+        std::fprintf(stderr, "Texture array requires at least one image!\n");
+        std::exit(EXIT_FAILURE);
+    }
+
+    uint32_t mipCount = uint32_t(std::max(width, height));
+    mipCount = (sizeof(GLsizei) * CHAR_BIT) - uint32_t(std::countl_zero(mipCount));
+
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, GLsizei(mipCount), GL_RGBA8,
+                   width, height, layerCount);
+
+    // Resample each image into its layer on the GPU,
+    // so that the sources do not need to have the same size.
+    GLuint fbos[2];
+    glGenFramebuffers(2, fbos);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+    for(int i = 0; i < layerCount; i++)
+    {
+        TextureGL tex = TextureGL(texPaths[size_t(i)], TextureGL::LINEAR,
+                                  edgeResolveMode);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, tex.textureId, 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  textureId, 0, i);
+        glBlitFramebuffer(0, 0, tex.width, tex.height,
+                          0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(2, fbos);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, edgeResolveMode);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, edgeResolveMode);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    std::printf("Texture array of %d layers (%dx%d) is created.\n",
+                layerCount, width, height);
+}
+
+// On-disk cooked cubemap cache
+// Compressed blocks of every level (faces are consecutive) are keyed by the
+// source path, its size & modification time and the face size.
+struct CookedCubemapHeader
+{
+    static constexpr uint32_t MAGIC = 0x45425543; // "CUBE"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t faceSize;
+    uint32_t levels;
+};
+
+// Size of the 4x4 blocks (16 bytes each) of all six faces of a level
+size_t CompressedCubeLevelSize(int faceSize, int level)
+{
+    size_t levelSize = size_t(std::max(faceSize >> level, 1));
+    size_t blockCount = (levelSize + 3) / 4;
+    return blockCount * blockCount * 16 * 6;
+}
+
+CubemapGL::CubemapGL(const std::string& equirectPath, bool compress)
+{
+    // Face size is only known after the image is decoded, key uses the file
+    // identity instead so that a cache hit does not need to decode it.
+    std::error_code err;
+    uint64_t key = HashFNV1a(equirectPath);
+    key = HashFNV1a(std::to_string(std::filesystem::file_size(equirectPath, err)), key);
+    auto writeTime = std::filesystem::last_write_time(equirectPath, err);
+    key = HashFNV1a(std::to_string(writeTime.time_since_epoch().count()), key);
+    key = HashFNV1a(std::to_string(COMPRESSED_FORMAT), key);
+
+    std::string cachePath;
+    if(compress && !cacheDir.empty())
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.cube",
+                      static_cast<unsigned long long>(key));
+        cachePath = cacheDir + "/" + name;
+        if(LoadCooked(cachePath, key))
+        {
+            std::printf("Cubemap \"%s\" (%dx%d) is loaded from cache.\n",
+                        equirectPath.c_str(), faceSize, faceSize);
+            return;
+        }
+    }
+
+    TextureGL source = TextureGL(equirectPath, TextureGL::LINEAR, TextureGL::REPEAT);
+    Convert(source.textureId, source.width);
+
+    if(compress)
+    {
+        // Driver compresses the uploaded texels (slow, hence the cache)
+        GLuint compressedId = 0;
+        glGenTextures(1, &compressedId);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, compressedId);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        std::vector<uint8_t> texels(size_t(faceSize) * size_t(faceSize) * 4);
+        for(int level = 0; level < levels; level++)
+        {
+            GLsizei levelSize = std::max(faceSize >> level, 1);
+            for(int face = 0; face < 6; face++)
+            {
+                glGetTextureSubImage(textureId, level, 0, 0, face,
+                                     levelSize, levelSize, 1,
+                                     GL_RGBA, GL_UNSIGNED_BYTE,
+                                     GLsizei(texels.size()), texels.data());
+                glTexImage2D(GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face), level,
+                             GLint(COMPRESSED_FORMAT), levelSize, levelSize, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+            }
+        }
+        glDeleteTextures(1, &textureId);
+        textureId = compressedId;
+        format = COMPRESSED_FORMAT;
+        if(!cachePath.empty()) SaveCooked(cachePath, key);
+    }
+
+    SetSampling();
+
+    size_t sourceBytes = size_t(source.width) * size_t(source.height) * size_t(source.channelCount);
+    size_t faceBytes = (compress) ? CompressedCubeLevelSize(faceSize, 0)
+                                  : size_t(faceSize) * size_t(faceSize) * 4 * 6;
+    std::printf("Cubemap \"%s\" (%dx%d) is created, level 0 is %zu KiB (source %zu KiB).\n",
+                equirectPath.c_str(), faceSize, faceSize,
+                faceBytes / 1024, sourceBytes / 1024);
+}
+
+CubemapGL::CubemapGL(const uint8_t* equirectPixels, int width, int height)
+{
+    uint32_t mipCount = uint32_t(std::max(width, height));
+    mipCount = (sizeof(GLsizei) * CHAR_BIT) - uint32_t(std::countl_zero(mipCount));
+
+    GLuint sourceId = 0;
+    glGenTextures(1, &sourceId);
+    glBindTexture(GL_TEXTURE_2D, sourceId);
+    glTexStorage2D(GL_TEXTURE_2D, GLsizei(mipCount), GL_RGBA8, width, height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, equirectPixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    Convert(sourceId, width);
+    glDeleteTextures(1, &sourceId);
+    SetSampling();
+}
+
+void CubemapGL::Convert(GLuint equirectId, int equirectWidth)
+{
+    faceSize = std::max(equirectWidth / 4, 1);
+    levels = int(sizeof(GLsizei) * CHAR_BIT) - std::countl_zero(uint32_t(faceSize));
+    format = GL_RGBA8;
+
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, GL_RGBA8, faceSize, faceSize);
+
+    ShaderGL convert = ShaderGL(ShaderGL::COMPUTE, "shaders/equirect_cube.comp");
+    if(convert.Wait() != ShaderGL::READY)
+    {
+        std::fprintf(stderr, "Unable to convert the equirectangular image to a cubemap!\n");
+        std::exit(EXIT_FAILURE);
+    }
+    glUseProgram(convert.shaderId);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, equirectId);
+    glBindImageTexture(0, textureId, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    GLuint groupCount = (GLuint(faceSize) + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    glDispatchCompute(groupCount, groupCount, 6);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glUseProgram(0);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+}
+
+void CubemapGL::SetSampling() const
+{
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+bool CubemapGL::LoadCooked(const std::string& cachePath, uint64_t key)
+{
+    std::ifstream file(cachePath, std::ios::binary | std::ios::ate);
+    if(!file) return false;
+    uint64_t fileSize = uint64_t(file.tellg());
+    file.seekg(0);
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxSize);
+    CookedCubemapHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(CookedCubemapHeader));
+    bool valid = (file &&
+                  header.magic == CookedCubemapHeader::MAGIC &&
+                  header.version == CookedCubemapHeader::VERSION &&
+                  header.key == key &&
+                  header.format == COMPRESSED_FORMAT &&
+                  header.faceSize > 0 && header.faceSize <= uint32_t(maxSize) &&
+                  header.levels > 0 && header.levels <= uint32_t(std::bit_width(header.faceSize)));
+    // Blocks must be in the file before they are allocated
+    uint64_t blockBytes = 0;
+    for(uint32_t level = 0; valid && level < header.levels; level++)
+        blockBytes += CompressedCubeLevelSize(int(header.faceSize), int(level));
+    valid = valid && (blockBytes <= fileSize - sizeof(CookedCubemapHeader));
+    std::vector<std::vector<char>> blocks;
+    for(uint32_t level = 0; valid && level < header.levels; level++)
+    {
+        blocks.emplace_back(CompressedCubeLevelSize(int(header.faceSize), int(level)));
+        file.read(blocks.back().data(), std::streamsize(blocks.back().size()));
+        valid = bool(file);
+    }
+    file.close();
+    if(!valid)
+    {
+        std::printf("[WARNING]: Cooked cubemap \"%s\" is stale, recooking.\n",
+                    cachePath.c_str());
+        std::error_code err;
+        std::filesystem::remove(cachePath, err);
+        return false;
+    }
+
+    faceSize = int(header.faceSize);
+    levels = int(header.levels);
+    format = COMPRESSED_FORMAT;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, format, faceSize, faceSize);
+    for(int level = 0; level < levels; level++)
+    {
+        GLsizei levelSize = std::max(faceSize >> level, 1);
+        glCompressedTextureSubImage3D(textureId, level, 0, 0, 0,
+                                      levelSize, levelSize, 6, format,
+                                      GLsizei(blocks[size_t(level)].size()),
+                                      blocks[size_t(level)].data());
+    }
+    SetSampling();
+    return true;
+}
+
+void CubemapGL::SaveCooked(const std::string& cachePath, uint64_t key) const
+{
+    std::error_code err;
+    std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), err);
+    std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+    CookedCubemapHeader header =
+    {
+        .magic    = CookedCubemapHeader::MAGIC,
+        .version  = CookedCubemapHeader::VERSION,
+        .key      = key,
+        .format   = uint32_t(format),
+        .faceSize = uint32_t(faceSize),
+        .levels   = uint32_t(levels)
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(CookedCubemapHeader));
+    std::vector<char> blocks;
+    for(int level = 0; level < levels; level++)
+    {
+        blocks.resize(CompressedCubeLevelSize(faceSize, level));
+        glGetCompressedTextureImage(textureId, level, GLsizei(blocks.size()), blocks.data());
+        file.write(blocks.data(), std::streamsize(blocks.size()));
+    }
+    if(!file)
+        std::printf("[WARNING]: Unable to write cooked cubemap \"%s\".\n",
+                    cachePath.c_str());
+}
+
 void SetupGLFWErrorCallback()
 {
     // Local function as lambda, should not capture anything
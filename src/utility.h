@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
 #include <cassert>
 
 #include <glad/glad.h>
@@ -19,6 +22,18 @@ void MouseScrollCallback(GLFWwindow*, double dx, double dy);
 void FramebufferChangeCallback(GLFWwindow*, int w, int h);
 void KeyboardCallback(GLFWwindow*, int button, int scancode, int action, int mode);
 
+// 64-bit FNV-1a, keys of the on-disk caches
+uint64_t HashFNV1a(std::string_view data, uint64_t hash = 0xCBF29CE484222325ull);
+
+// Reverse-Z perspective with an infinite far plane, for the [0, 1] clip
+// volume (glClipControl). Depth is 1 at "zNear" and goes to 0 at infinity,
+// so it is tested with GL_GREATER and cleared to 0.
+glm::mat4 PerspectiveReverseZ(float fovY, float aspect, float zNear);
+// Floating origin; world matrices are kept in double precision and only
+// converted to float relative to "origin" (the camera) before the upload,
+// so the precision is always concentrated around the viewer
+glm::mat4 CameraRelative(const glm::dmat4& model, const glm::dvec3& origin);
+
 struct CallbackPointersGLFW
 {
     GLFWcursorposfun       mMoveCallback   = MouseMoveCallback;
@@ -32,6 +47,8 @@ struct GLState
 {
     GLFWwindow* window = nullptr;
     GLuint      renderPipeline = 0u;
+    GLuint      emptyVao = 0u;      // For the attribute-less draws (vertices from gl_VertexID)
+    GLuint      presentFbo = 0u;    // Read framebuffer of the blit to the window
 
     // Data from callbacks
     // FBO Params
@@ -39,10 +56,8 @@ struct GLState
     int32_t height = 0;
     // Camera
     glm::vec3 gaze  = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 pos   = glm::vec3(0.0f, 0.0f, 2.0f);
+    glm::dvec3 pos  = glm::dvec3(0.0, 0.0, 2.0);  // World space (double, see "CameraRelative")
     glm::vec3 up    = glm::vec3(0.0f, 1.0f, 0.0f);
-    // Render mode
-    uint32_t mode = 0;
 
     // Constructors, Movement & Destructor
                 GLState(const char* const windowName,
@@ -57,16 +72,8 @@ struct GLState
 
 
     //Some useful variables
-    
-    glm::mat4 earthModel =  glm::mat4(1.0f);
-    glm::mat4 moonModel;
-    glm::mat4 jupiterModel;
-    glm::mat4 sunModel;
-
-    glm::vec3 earthVec;
-    glm::vec3 moonVec;
-    glm::vec3 jupiterVec;
-    glm::vec3 sunVec;
+    // Bodies are in the "SceneGraph", this is derived from it every frame
+    glm::vec3 lightDir = glm::vec3(1.0f, 0.0f, 0.0f); // Towards the Sun (directional)
 
     uint32_t cameraMode = 0;
     float FOV = 45.0f;
@@ -79,9 +86,10 @@ struct GLState
     float SimSpeed = 1.0f;
 
     float cameraDistance = 18.0f;
-    
-    glm::mat4 lightSpaceMatrix;
 
+    uint32_t shadowQuality = 1; // "ShadowQuality" of the shader library
+    uint32_t shadowMode = 0;    // "ShadowMode" of the shader library
+    
    
 };
 
@@ -89,18 +97,62 @@ struct ShaderGL
 {   
     enum Type
     {
-        VERTEX      = GL_VERTEX_SHADER,
-        FRAGMENT    = GL_FRAGMENT_SHADER
+        VERTEX          = GL_VERTEX_SHADER,
+        GEOMETRY        = GL_GEOMETRY_SHADER,
+        FRAGMENT        = GL_FRAGMENT_SHADER,
+        COMPUTE         = GL_COMPUTE_SHADER,
+        TESS_CONTROL    = GL_TESS_CONTROL_SHADER,
+        TESS_EVALUATION = GL_TESS_EVALUATION_SHADER
     };
+    enum Status
+    {
+        PENDING,    // Compile/link (or binary load) is issued
+        READY,
+        FAILED
+    };
+    // GL_KHR_parallel_shader_compile
+    static constexpr GLenum COMPLETION_STATUS_KHR = 0x91B1;
+
+    // Linked programs are stored here (relative to the working directory)
+    // and reloaded on the next launch. Empty disables the cache.
+    static inline std::string binaryCacheDir = "shader_cache";
+    // Set by "GLState" when the driver supports parallel compilation,
+    // "Poll" can then query completion without blocking.
+    static inline bool parallelCompile = false;
+
+    GLuint      shaderId    = 0;
+    Status      status      = PENDING;
+    Type        type        = VERTEX;
+    GLuint      stageId     = 0;        // Valid only while compiling
+    bool        fromBinary  = false;
+    std::string path;
+    std::string defineList;
+    std::string source;
+    std::string cachePath;
+    uint64_t    cacheKey    = 0;
 
-    GLuint      shaderId = 0;
     // Constructors, Movement & Destructor
-                ShaderGL(Type t, const std::string& path);
+    // Each define is injected as "#define <define>" after the "#version"
+    // line of the source, so specialized variants can be compiled
+    // from the same file.
+    // Constructor only issues the work, the program is usable after
+    // "Poll" returns true (or "Wait" returns) with "READY" status.
+                ShaderGL(Type t, const std::string& path,
+                         const std::vector<std::string>& defines = {});
                 ShaderGL(const ShaderGL&) = delete;
                 ShaderGL(ShaderGL&&);
     ShaderGL&   operator=(const ShaderGL&) = delete;
     ShaderGL&   operator=(ShaderGL&&);
                 ~ShaderGL();
+
+    // Non-blocking, returns true when the shader is no longer pending
+    bool        Poll();
+    // Blocks until the shader is no longer pending
+    Status      Wait();
+
+    private:
+    void        IssueCompile();
+    void        Finalize();
 };
 
 struct MeshGL
@@ -116,15 +168,35 @@ struct MeshGL
     GLuint iBufferId  = 0;
     GLuint vaoId      = 0;
     GLuint indexCount = 0;
+    // Object space bounds of the positions (sphere is xyz: center, w: radius)
+    glm::vec3 aabbMin = glm::vec3(0.0f);
+    glm::vec3 aabbMax = glm::vec3(0.0f);
+    glm::vec4 boundingSphere = glm::vec4(0.0f);
     // Constructors, Movement & Destructor
             MeshGL(const std::string& objPath);
+            // Attributes are per vertex (single indexed)
+            MeshGL(const std::vector<glm::vec3>& positions,
+                   const std::vector<glm::vec3>& normals,
+                   const std::vector<glm::vec2>& uvs,
+                   const std::vector<uint32_t>& indices);
             MeshGL(const MeshGL&) = delete;
             MeshGL(MeshGL&&);
     MeshGL& operator=(const MeshGL&) = delete;
     MeshGL& operator=(MeshGL&&);
             ~MeshGL();
+
+    private:
+    // Computes the bounds, creates the buffers & the VAO
+    void    Upload(const std::vector<glm::vec3>& positions,
+                   const std::vector<glm::vec3>& normals,
+                   const std::vector<glm::vec2>& uvs,
+                   const std::vector<uint32_t>& indices);
 };
 
+// Unit sphere from an icosahedron, each subdivision quadruples the triangles
+// (tessellated variants draw these as patches)
+MeshGL GenerateIcosphere(uint32_t subdivisions);
+
 struct TextureGL
 {
     enum SampleMode
@@ -154,30 +226,104 @@ struct TextureGL
                 ~TextureGL();
 };
 
+struct TextureArrayGL
+{
+    GLuint      textureId   = 0;
+    int         width       = 0;
+    int         height      = 0;
+    int         layerCount  = 0;
+    // Each image is loaded via "TextureGL" and resampled (linear blit)
+    // to "width x height" so differently sized maps can share the array.
+                    TextureArrayGL(const std::vector<std::string>& texPaths,
+                                   int width, int height,
+                                   TextureGL::EdgeResolve);
+                    TextureArrayGL(const TextureArrayGL&) = delete;
+                    TextureArrayGL(TextureArrayGL&&);
+    TextureArrayGL& operator=(const TextureArrayGL&) = delete;
+    TextureArrayGL& operator=(TextureArrayGL&&);
+                    ~TextureArrayGL();
+};
+
+struct CubemapGL
+{
+    // Cooked (block compressed) cubemaps are stored here (relative to the
+    // working directory) and loaded on the next launch. Empty disables the cache.
+    static inline std::string cacheDir = "texture_cache";
+    // BC7, 1 byte per texel (RGBA8 is 4)
+    static constexpr GLenum COMPRESSED_FORMAT = GL_COMPRESSED_RGBA_BPTC_UNORM;
+    static constexpr GLuint WORK_GROUP_SIZE = 8;    // Must match "equirect_cube.comp"
+
+    GLuint      textureId   = 0;
+    int         faceSize    = 0;
+    int         levels      = 0;
+    GLenum      format      = GL_RGBA8;
+    // Converts an equirectangular image into a mipmapped cubemap on the GPU.
+    // Faces are "width / 4" of the source, which keeps the texel density
+    // of the equator while dropping the oversampled rows near the poles.
+    // Compressed result is cooked into "cacheDir".
+                CubemapGL(const std::string& equirectPath, bool compress);
+    // Same conversion from RGBA8 pixels in memory (uncompressed, not cached)
+                CubemapGL(const uint8_t* equirectPixels, int width, int height);
+                CubemapGL(const CubemapGL&) = delete;
+                CubemapGL(CubemapGL&&);
+    CubemapGL&  operator=(const CubemapGL&) = delete;
+    CubemapGL&  operator=(CubemapGL&&);
+                ~CubemapGL();
+
+    private:
+    // Allocates the RGBA8 faces and fills them from the 2D texture
+    void        Convert(GLuint equirectId, int equirectWidth);
+    void        SetSampling() const;
+    bool        LoadCooked(const std::string& cachePath, uint64_t key);
+    void        SaveCooked(const std::string& cachePath, uint64_t key) const;
+};
+
 // Inline Definitions
 inline ShaderGL::ShaderGL(ShaderGL&& other)
-    : shaderId(other.shaderId)
-{
-    other.shaderId = 0;
-}
+    : shaderId(std::exchange(other.shaderId, 0))
+    , status(other.status)
+    , type(other.type)
+    , stageId(std::exchange(other.stageId, 0))
+    , fromBinary(other.fromBinary)
+    , path(std::move(other.path))
+    , defineList(std::move(other.defineList))
+    , source(std::move(other.source))
+    , cachePath(std::move(other.cachePath))
+    , cacheKey(other.cacheKey)
+{}
 
 inline ShaderGL& ShaderGL::operator=(ShaderGL&& other)
 {
     assert(this != &other);
-    shaderId = other.shaderId;
-    other.shaderId = 0;
+    if(shaderId) glDeleteProgram(shaderId);
+    if(stageId) glDeleteShader(stageId);
+    shaderId    = std::exchange(other.shaderId, 0);
+    status      = other.status;
+    type        = other.type;
+    stageId     = std::exchange(other.stageId, 0);
+    fromBinary  = other.fromBinary;
+    path        = std::move(other.path);
+    defineList  = std::move(other.defineList);
+    source      = std::move(other.source);
+    cachePath   = std::move(other.cachePath);
+    cacheKey    = other.cacheKey;
     return *this;
 }
 
 inline ShaderGL::~ShaderGL()
 {
     if(shaderId) glDeleteProgram(shaderId);
+    if(stageId) glDeleteShader(stageId);
 }
 
 inline MeshGL::MeshGL(MeshGL&& other)
     : vBufferId(other.vBufferId)
     , iBufferId(other.iBufferId)
     , vaoId(other.vaoId)
+    , indexCount(other.indexCount)
+    , aabbMin(other.aabbMin)
+    , aabbMax(other.aabbMax)
+    , boundingSphere(other.boundingSphere)
 {
     other.vBufferId = 0;
     other.iBufferId = 0;
@@ -190,6 +336,10 @@ inline MeshGL& MeshGL::operator=(MeshGL&& other)
     vBufferId = other.vBufferId;
     iBufferId = other.iBufferId;
     vaoId = other.vaoId;
+    indexCount = other.indexCount;
+    aabbMin = other.aabbMin;
+    aabbMax = other.aabbMax;
+    boundingSphere = other.boundingSphere;
     other.vBufferId = 0;
     other.iBufferId = 0;
     other.vaoId = 0;
@@ -222,3 +372,51 @@ inline TextureGL::~TextureGL()
     if(textureId) glDeleteTextures(1, &textureId);
 }
 
+inline TextureArrayGL::TextureArrayGL(TextureArrayGL&& other)
+    : textureId(other.textureId)
+    , width(other.width)
+    , height(other.height)
+    , layerCount(other.layerCount)
+{
+    other.textureId = 0;
+}
+
+inline TextureArrayGL& TextureArrayGL::operator=(TextureArrayGL&& other)
+{
+    assert(this != &other);
+    if(textureId) glDeleteTextures(1, &textureId);
+    textureId = other.textureId;
+    width = other.width;
+    height = other.height;
+    layerCount = other.layerCount;
+    other.textureId = 0;
+    return *this;
+}
+
+inline TextureArrayGL::~TextureArrayGL()
+{
+    if(textureId) glDeleteTextures(1, &textureId);
+}
+inline CubemapGL::CubemapGL(CubemapGL&& other)
+    : textureId(std::exchange(other.textureId, 0))
+    , faceSize(other.faceSize)
+    , levels(other.levels)
+    , format(other.format)
+{}
+
+inline CubemapGL& CubemapGL::operator=(CubemapGL&& other)
+{
+    assert(this != &other);
+    if(textureId) glDeleteTextures(1, &textureId);
+    textureId = std::exchange(other.textureId, 0);
+    faceSize = other.faceSize;
+    levels = other.levels;
+    format = other.format;
+    return *this;
+}
+
+inline CubemapGL::~CubemapGL()
+{
+    if(textureId) glDeleteTextures(1, &textureId);
+}
+
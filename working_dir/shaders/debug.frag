@@ -1,11 +1,32 @@
 #version 430
 /*
-	File Name	: color.vert
+	File Name	: debug.frag
 	Author		: Bora Yalciner
 	Description	:
 
 		Basic fragment shader that just outputs
 		color to the FBO
+
+		Compiled into specialized variants, exactly one of
+		these must be defined by the shader library;
+			EMISSIVE     : Just white (sun)
+			CLOUDS       : Lit, alpha blended cloud layer
+			LIT_EARTH    : Blinn-Phong + shadows (NIGHT_MAP, SPEC_MAP optional)
+			LIT_ROCKY    : Phong + shadows (moon, jupiter)
+
+		Lit variants take SHADOW_TAPS (1, 4 or 9) as the
+		shadow filter quality, SHADOW_EVSM to sample the
+		prefiltered moments instead of the depth, or
+		SHADOW_ANALYTIC to compute the shadows from the
+		occluder spheres instead of the shadow map.
+
+		IMPOSTOR (with EMISSIVE or LIT_ROCKY) ray-casts a
+		sphere through the quad of "impostor.vert"; world
+		position, normal, UVs and the depth are computed
+		per fragment instead of being interpolated.
+		TESSELLATED (with LIT_EARTH) computes the UVs from
+		the object space direction of "planet.tese" (or
+		"terrain.vert").
 */
 
 
@@ -15,7 +36,7 @@
 #define IN_NORMAL    layout(location = 1)
 #define IN_COLOR     layout(location = 2)
 #define IN_WORLD_POS layout(location = 3)
-#define IN_DEPTH     layout(location = 4) // for shadows
+#define IN_OBJECT_DIR layout(location = 4)
 
 // This output must match to the COLOR_ATTACHMENTi (where 'i' is this location)
 #define OUT_FBO      layout(location = 0)
@@ -26,208 +47,423 @@
 #define T_NIGHT_MAP  layout(binding = 2)
 #define T_CLOUD      layout(binding = 3)
 #define T_SPEC_MAP   layout(binding = 4)
+#define T_SHADOW_MOMENTS layout(binding = 5) // EVSM
 
 // This must match the first parameter of glUniform...() calls
-#define U_MODE       layout(location = 0) //Render mode 0,1,2 or 3
 #define U_SUN_DIR    layout(location = 1) //Sun direction
 #define U_CAMERA_POS layout(location = 2) //For specular
-#define U_LIGHT_MAT  layout(location = 5) //Light matrix
-#define U_USE_NIGHT  layout(location = 6)
+#define U_IMPOSTOR_SPHERE    layout(location = 4) // xyz: world center, w: radius
+#define U_IMPOSTOR_VIEW_PROJ layout(location = 5)
+#define U_IMPOSTOR_TO_OBJECT layout(location = 6) // World to object rotation (UVs)
+
+// These must match ShadowCascadesGL::CASCADE_COUNT & UBO_CASCADES
+#define CASCADE_COUNT	4
+#define UBO_CASCADES	layout(std140, binding = 0)
+// These must match SphereOccludersGL::MAX_OCCLUDERS & UBO_OCCLUDERS
+#define MAX_OCCLUDERS	8
+#define UBO_OCCLUDERS	layout(std140, binding = 1)
+// These must match ShadowMomentsGL::EXPONENT_POS & EXPONENT_NEG
+#define EVSM_EXPONENTS	vec2(40.0, 5.0)
+
+#if defined(LIT_EARTH) || defined(LIT_ROCKY)
+	#define LIT
+#endif
 
+#define PI 3.14159265358979
 
 // Input
+#ifdef IMPOSTOR
+in IN_WORLD_POS vec3 fQuadPos;
+// Computed by "RaycastSphere" instead
+vec2 fUV       = vec2(0.0);
+vec3 fNormal   = vec3(0.0);
+vec3 fWorldPos = vec3(0.0);
+#elif defined(TESSELLATED)
+in IN_NORMAL     vec3 fNormal;
+in IN_WORLD_POS  vec3 fWorldPos;
+in IN_OBJECT_DIR vec3 fObjectDir;
+vec2 fUV = vec2(0.0);   // See "SphereUV"
+#else
 in IN_UV        vec2 fUV;
 in IN_NORMAL    vec3 fNormal;
 in IN_WORLD_POS vec3 fWorldPos;
-in IN_DEPTH     float fDepth;
+#endif
 
 // Output
 // This parameter goes to the framebuffer
 out OUT_FBO vec4 fboColor;
-
-// Uniforms
-U_MODE       uniform uint uMode;
+#ifdef IMPOSTOR
+// Sphere is behind the quad (smaller reverse-Z depth),
+// early depth test can still reject
+layout(depth_less) out float gl_FragDepth;
+#endif
+
+// Uniforms & Textures
+#if defined(LIT) || defined(CLOUDS)
 U_SUN_DIR    uniform vec3 uSunDir;
-U_LIGHT_MAT  uniform mat4 uLightSpaceMatrix;
+#endif
+
+#if defined(LIT) || defined(IMPOSTOR)
 U_CAMERA_POS uniform vec3 uCameraPos;
-U_USE_NIGHT  uniform uint uUseNightMap;
+#endif
 
-// Textures
-uniform T_ALBEDO    sampler2D tAlbedo;
-uniform T_SHADOWMAP sampler2D tShadowMap;
-uniform T_NIGHT_MAP sampler2D tNightMap;
-uniform T_CLOUD     sampler2D tCloud;
-uniform T_SPEC_MAP  sampler2D tSpecMap;
-void main(void)
-{
-    
-    // Shadow check
-    if (uMode == 3) {
-        fboColor = vec4(fDepth, 0.0, 0.0, 1.0); 
-        return;
-    }
+#ifdef IMPOSTOR
+U_IMPOSTOR_SPHERE    uniform vec4 uSphere;
+U_IMPOSTOR_VIEW_PROJ uniform mat4 uViewProj;
+U_IMPOSTOR_TO_OBJECT uniform mat3 uWorldToObject;
+#endif
 
-    // Sun / Just white
-    if (uMode == 0) {
-        fboColor = vec4(1.0, 1.0, 1.0, 1.0);
-        return;
-    }
+#if defined(LIT) && defined(SHADOW_ANALYTIC)
+UBO_OCCLUDERS uniform SphereOccluders
+{
+	vec4 uOccluders[MAX_OCCLUDERS];	// xyz: center, w: radius
+	vec4 uSun;						// xyz: center, w: radius
+	uint uOccluderCount;
+};
+#elif defined(LIT)
+#ifdef SHADOW_EVSM
+uniform T_SHADOW_MOMENTS sampler2DArray tShadowMoments; // Cascade per layer (mipmapped)
+#else
+uniform T_SHADOWMAP sampler2DArrayShadow tShadowMap; // Cascade per layer (compare mode)
+#endif
+
+UBO_CASCADES uniform ShadowCascades
+{
+	mat4 uCascadeMatrix[CASCADE_COUNT];
+	vec4 uCascadeTexel;			// World size of a texel
+	vec4 uCascadeDepthRange;	// World depth range
+};
+#endif
 
-    
-    vec4 texColor = texture(tAlbedo, fUV);
+#ifdef LIT
+uniform T_ALBEDO    sampler2D tAlbedo;
+#endif
 
-    // No shading/shadowing
-    if (uMode == 1) {
-        fboColor = texColor;
-        return;
-    }
-    if(uMode == 4)
-    {
-        vec4 c = texture(tCloud, fUV);
+#ifdef NIGHT_MAP
+uniform T_NIGHT_MAP sampler2D tNightMap;
+#endif
 
-        if(c.a < 0.05)
-            discard;
+#ifdef CLOUDS
+uniform T_CLOUD     sampler2D tCloud;
+#endif
 
-            vec3 N = normalize(fNormal);
-        vec3 L = normalize(uSunDir);
+#ifdef SPEC_MAP
+uniform T_SPEC_MAP  sampler2D tSpecMap;
+#endif
 
-        float diff = max(dot(N, L), 0.0);
-        float ambient = 0.4;
-        float intensity = ambient + diff*0.6;
+#if defined(LIT) && defined(SHADOW_ANALYTIC)
+// Overlapping area of two discs (radii r0, r1, center distance d)
+float DiscOverlap(float r0, float r1, float d)
+{
+	if (d >= r0 + r1) return 0.0;
+	// One disc is inside of the other
+	float rMin = min(r0, r1);
+	if (d <= abs(r0 - r1)) return PI * rMin * rMin;
+
+	float d0 = (d * d + r0 * r0 - r1 * r1) / (2.0 * d * r0);
+	float d1 = (d * d + r1 * r1 - r0 * r0) / (2.0 * d * r1);
+	float k  = (-d + r0 + r1) * (d + r0 - r1) * (d - r0 + r1) * (d + r0 + r1);
+	return (r0 * r0 * acos(clamp(d0, -1.0, 1.0)) +
+			r1 * r1 * acos(clamp(d1, -1.0, 1.0)) -
+			0.5 * sqrt(max(k, 0.0)));
+}
 
-        vec3 rgb = c.rgb * intensity;
+float ShadowFactor(vec3 normal, vec3 lightDir)
+{
+	// Angular radius & direction of the Sun's disk
+	vec3  toSun    = uSun.xyz - fWorldPos;
+	float sunDist  = length(toSun);
+	vec3  sunDir   = toSun / sunDist;
+	float sunAngle = asin(min(uSun.w / sunDist, 1.0));
+	float sunArea  = PI * sunAngle * sunAngle;
+
+	float visible = 1.0;
+	for (uint i = 0u; i < uOccluderCount; ++i) {
+		vec3  toOcc   = uOccluders[i].xyz - fWorldPos;
+		float occDist = length(toOcc);
+		// Own sphere (fragment is on its surface, N.L handles it)
+		// or the occluder is behind the Sun / the fragment
+		if (occDist <= uOccluders[i].w * 1.001 ||
+			occDist >= sunDist || dot(toOcc, sunDir) <= 0.0)
+			continue;
+
+		// Angular radius of the occluder & the angle between the disks
+		// (atan2 form, acos is imprecise for the tiny angles here)
+		vec3  occDir   = toOcc / occDist;
+		float occAngle = asin(min(uOccluders[i].w / occDist, 1.0));
+		float sep      = atan(length(cross(occDir, sunDir)), dot(occDir, sunDir));
+		visible *= 1.0 - DiscOverlap(sunAngle, occAngle, sep) / sunArea;
+	}
+	return 1.0 - clamp(visible, 0.0, 1.0);
+}
+#elif defined(LIT) && defined(SHADOW_EVSM)
+// Moments are already filtered (see "shadow_moments.comp"),
+// a single trilinear fetch gives the soft shadow.
+// Minimum variance relative to the warped depth & light bleeding reduction
+#define EVSM_VARIANCE_BIAS	0.0001
+#define EVSM_BLEED_CUT		0.25
+
+// Upper bound of the lit fraction (one tailed Chebyshev)
+float Chebyshev(vec2 moments, float depth, float minVariance)
+{
+	if (depth <= moments.x) return 1.0;
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d        = depth - moments.x;
+	float pMax     = variance / (variance + d * d);
+	return clamp((pMax - EVSM_BLEED_CUT) / (1.0 - EVSM_BLEED_CUT), 0.0, 1.0);
+}
 
-        fboColor = vec4(rgb, c.a);
-        return;
-    }
+float ShadowFactor(vec3 normal, vec3 lightDir)
+{
+	vec2 texelSize = 1.0 / vec2(textureSize(tShadowMoments, 0).xy);
+	// Blurred footprint must stay inside of the selected cascade
+	vec2 margin = texelSize * 4.0;
+
+	// Gradients are computed from the world position, so that quads
+	// that straddle cascades do not select the coarsest mip
+	vec3 dPdx = dFdx(fWorldPos);
+	vec3 dPdy = dFdy(fWorldPos);
+
+	// Finest cascade that covers this fragment
+	for (int c = 0; c < CASCADE_COUNT; ++c) {
+		float worldTexel = uCascadeTexel[c];
+		vec3 offsetPos = fWorldPos + normal * worldTexel * 1.5;
+
+		vec3 projCoords = (uCascadeMatrix[c] * vec4(offsetPos, 1.0)).xyz;
+		vec2 shadowUV   = projCoords.xy * 0.5 + 0.5;
+		if (any(lessThan(shadowUV, margin)) ||
+			any(greaterThan(shadowUV, 1.0 - margin)) ||
+			projCoords.z > 1.0)
+			continue;
+
+		// Light space is orthographic, gradients are linear
+		vec2 dUVdx = (mat3(uCascadeMatrix[c]) * dPdx).xy * 0.5;
+		vec2 dUVdy = (mat3(uCascadeMatrix[c]) * dPdy).xy * 0.5;
+		vec4 moments = textureGrad(tShadowMoments, vec3(shadowUV, float(c)), dUVdx, dUVdy);
+
+		// Same warp as the moments (depth is in [0, 1], see "WarpDepth")
+		float depth = projCoords.z * 2.0 - 1.0;
+		vec2 warped = vec2(exp(EVSM_EXPONENTS.x * depth), -exp(-EVSM_EXPONENTS.y * depth));
+		vec2 depthScale  = EVSM_VARIANCE_BIAS * EVSM_EXPONENTS * warped;
+		vec2 minVariance = depthScale * depthScale;
+
+		// Returns the lit fraction
+		float lit = min(Chebyshev(moments.xy, warped.x, minVariance.x),
+						Chebyshev(moments.zw, warped.y, minVariance.y));
+		return 1.0 - lit;
+	}
+	// Outside of the shadow distance
+	return 0.0;
+}
+#elif defined(LIT)
+// Hardware compared (GL_COMPARE_REF_TO_TEXTURE) taps, each one is
+// a bilinear filtered 2x2 PCF. Kernels are in texels.
+#ifndef SHADOW_TAPS
+	#define SHADOW_TAPS 4
+#endif
+
+#if SHADOW_TAPS == 1
+const vec2 SHADOW_KERNEL[1] = vec2[](vec2(0.0));
+#elif SHADOW_TAPS == 4
+// Rotated grid
+const vec2 SHADOW_KERNEL[4] = vec2[](vec2(-0.5, -1.5), vec2( 1.5, -0.5),
+                                     vec2( 0.5,  1.5), vec2(-1.5,  0.5));
+#elif SHADOW_TAPS == 9
+// Poisson disk, radius ~2 texels (same footprint as the old 5x5 loop)
+const vec2 SHADOW_KERNEL[9] = vec2[](vec2( 0.00,  0.00), vec2(-1.46, -0.85),
+                                     vec2( 1.62, -0.74), vec2(-0.18,  1.86),
+                                     vec2( 0.52, -1.80), vec2(-1.82,  0.66),
+                                     vec2( 1.31,  1.24), vec2(-0.69, -0.43),
+                                     vec2( 0.77,  0.35));
+#else
+	#error "SHADOW_TAPS must be 1, 4 or 9!"
+#endif
+
+float ShadowFactor(vec3 normal, vec3 lightDir)
+{
+	vec2 texelSize = 1.0 / vec2(textureSize(tShadowMap, 0).xy);
+	// Kernel must stay inside of the selected cascade
+	vec2 margin = texelSize * 3.0;
+
+	// Finest cascade that covers this fragment
+	for (int c = 0; c < CASCADE_COUNT; ++c) {
+		// Normal offset, scaled with the texel size of the cascade
+		float worldTexel = uCascadeTexel[c];
+		vec3 offsetPos = fWorldPos + normal * worldTexel * 1.5;
+
+		vec3 projCoords = (uCascadeMatrix[c] * vec4(offsetPos, 1.0)).xyz;
+		vec3 shadowUV   = vec3(projCoords.xy * 0.5 + 0.5, projCoords.z);
+		if (any(lessThan(shadowUV.xy, margin)) ||
+			any(greaterThan(shadowUV.xy, 1.0 - margin)) ||
+			shadowUV.z > 1.0)
+			continue;
+
+		// Half a texel in depth (window space [0, 1]),
+		// slightly more on grazing angles
+		float slope = 1.0 - max(dot(normal, lightDir), 0.0);
+		float bias  = worldTexel * (0.5 + slope) / uCascadeDepthRange[c];
+		float currentDepth = shadowUV.z - bias;
+
+		// Returns the lit fraction
+		float lit = 0.0;
+		for (int i = 0; i < SHADOW_TAPS; ++i) {
+			vec2 uv = shadowUV.xy + SHADOW_KERNEL[i] * texelSize;
+			lit += texture(tShadowMap, vec4(uv, float(c), currentDepth));
+		}
+		return 1.0 - lit / float(SHADOW_TAPS);
+	}
+	// Outside of the shadow distance
+	return 0.0;
+}
+#endif
+
+#if defined(IMPOSTOR) || defined(TESSELLATED)
+// Same mapping as the UVs of the sphere meshes ("n" is in object space).
+// U wraps at the seam; the alternative that is continuous over the
+// 2x2 quad is used, so the derivatives do not select the smallest mip
+// (textures repeat)
+vec2 SphereUV(vec3 n)
+{
+	float u     = atan(n.z, -n.x) / (2.0 * PI) + 0.5;
+	float uSeam = fract(u + 0.5) - 0.5;
+	return vec2((fwidth(u) <= fwidth(uSeam) + 1e-6) ? u : uSeam,
+				asin(clamp(n.y, -1.0, 1.0)) / PI + 0.5);
+}
+#endif
 
-    // Default rendering
-    if (uMode == 2) {
-        vec3 normal   = normalize(fNormal);
-        vec3 lightDir = normalize(uSunDir);
-        vec3 viewDir  = normalize(uCameraPos - fWorldPos);
-        vec3 halfDir  = normalize(lightDir + viewDir);
+#ifdef IMPOSTOR
+// Front intersection of the view ray
+void RaycastSphere(void)
+{
+	vec3  rayDir = normalize(fQuadPos - uCameraPos);
+	vec3  oc     = uCameraPos - uSphere.xyz;
+	float b      = dot(oc, rayDir);
+	float c      = dot(oc, oc) - uSphere.w * uSphere.w;
+	float h      = b * b - c;
+	if (h < 0.0) discard;
+
+	fWorldPos = uCameraPos + rayDir * (-b - sqrt(h));
+	fNormal   = (fWorldPos - uSphere.xyz) / uSphere.w;
+	fUV       = SphereUV(normalize(uWorldToObject * fNormal));
+
+	vec4 clip = uViewProj * vec4(fWorldPos, 1.0);
+	gl_FragDepth = clip.z / clip.w;
+}
+#endif
 
-        float NdotL = max(dot(normal, lightDir), 0.0);
-        float NdotH = max(dot(normal, halfDir), 0.0);
+void main(void)
+{
+#if defined(IMPOSTOR)
+	RaycastSphere();
+#elif defined(TESSELLATED)
+	fUV = SphereUV(normalize(fObjectDir));
+#endif
 
+#if defined(EMISSIVE)
+	// Sun / Just white
+	fboColor = vec4(1.0, 1.0, 1.0, 1.0);
 
-        float s = texture(tSpecMap, fUV).r;
+#elif defined(CLOUDS)
+	vec4 c = texture(tCloud, fUV);
 
+	if(c.a < 0.05)
+		discard;
 
-        float lowShininess  = 8.0;
-        float highShininess = 128.0;
-        float shininess     = mix(lowShininess, highShininess, s);
+	vec3 N = normalize(fNormal);
+	vec3 L = normalize(uSunDir);
 
+	float diff = max(dot(N, L), 0.0);
+	float ambient = 0.4;
+	float intensity = ambient + diff*0.6;
 
-        float ks = 0.6;
+	vec3 rgb = c.rgb * intensity;
 
-        float spec = 0.0;
-        if (NdotL > 0.0 && NdotH > 0.0) {
+	fboColor = vec4(rgb, c.a);
 
-            spec = ks * pow(NdotH, shininess) * NdotL;
-        }
+#elif defined(LIT_EARTH)
+	// Default rendering
+	vec3 normal   = normalize(fNormal);
+	vec3 lightDir = normalize(uSunDir);
+	vec3 viewDir  = normalize(uCameraPos - fWorldPos);
+	vec3 halfDir  = normalize(lightDir + viewDir);
 
-        vec3 specularColor = vec3(0.8, 0.9, 1.0) * spec;
+	float NdotL = max(dot(normal, lightDir), 0.0);
+	float NdotH = max(dot(normal, halfDir), 0.0);
 
+	#ifdef SPEC_MAP
+	float s = texture(tSpecMap, fUV).r;
+	#else
+	float s = 0.0;
+	#endif
 
+	float lowShininess  = 8.0;
+	float highShininess = 128.0;
+	float shininess     = mix(lowShininess, highShininess, s);
 
-        vec4 fragPosLightSpace = uLightSpaceMatrix * vec4(fWorldPos, 1.0);
-        vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-        vec3 shadowUV   = projCoords * 0.5 + 0.5;
+	float ks = 0.6;
 
-        float currentDepth = projCoords.z;
-        float shadow = 0.0;
-        float bias   = max(0.005 * (1.0 - dot(normal, lightDir)), 0.0005);
+	float spec = 0.0;
+	if (NdotL > 0.0 && NdotH > 0.0) {
 
-        if (projCoords.z > 1.0 ||
-            shadowUV.x < 0.0 || shadowUV.x > 1.0 ||
-            shadowUV.y < 0.0 || shadowUV.y > 1.0) {
+		spec = ks * pow(NdotH, shininess) * NdotL;
+	}
 
-            shadow = 0.0;
-            } else {
-                vec2 texelSize = 1.0 / textureSize(tShadowMap, 0);
-                for (int x = -2; x <= 2; ++x) {
-                    for (int y = -2; y <= 2; ++y) {
-                        float pcfDepth = texture(tShadowMap,
-                                                 shadowUV.xy + vec2(x, y) * texelSize).r;
-                                                 shadow += (currentDepth - bias) > pcfDepth ? 1.0 : 0.0;
-                    }
-                }
-                shadow /= 25.0;
-            }
+	vec3 specularColor = vec3(0.8, 0.9, 1.0) * spec;
 
+	float shadow = ShadowFactor(normal, lightDir);
 
-            vec3 texColor = texture(tAlbedo, fUV).rgb;
+	vec3 texColor = texture(tAlbedo, fUV).rgb;
 
-            float ambientStrength = 0.15;
-            vec3 ambientLight     = ambientStrength * vec3(1.0);
+	float ambientStrength = 0.15;
+	vec3 ambientLight     = ambientStrength * vec3(1.0);
 
+	float diffuseScale    = 1.0;
 
-            float diffuseScale    = 1.0;
+	vec3 diffuseLight =
+	(1.0 - shadow) * NdotL * vec3(1.0) * diffuseScale;
 
-            vec3 diffuseLight =
-            (1.0 - shadow) * NdotL * vec3(1.0) * diffuseScale;
+	vec3 specularLight =
+	(1.0 - shadow) * specularColor;
 
-            vec3 specularLight =
-            (1.0 - shadow) * specularColor;
+	vec3 base = (ambientLight + diffuseLight) * texColor + specularLight;
+	vec3 result = base;
+	#ifdef NIGHT_MAP
+	vec3 nightColor   = texture(tNightMap, fUV).rgb * 1.5;
+	float nightFactor = 1.0 - smoothstep(0.05, 0.25, NdotL);
+	result += nightColor * nightFactor;
+	#endif
 
-            vec3 base = (ambientLight + diffuseLight) * texColor + specularLight;
-            vec3 result = base;
-            if (uUseNightMap == 1u) {
-                vec3 nightColor   = texture(tNightMap, fUV).rgb * 1.5;
-                float nightFactor = 1.0 - smoothstep(0.05, 0.25, NdotL);
-                result += nightColor * nightFactor;
-            }
+	fboColor = vec4(result, 1.0);
 
-            fboColor = vec4(result, 1.0);
-    }
+#elif defined(LIT_ROCKY)
+	vec4 texColor = texture(tAlbedo, fUV);
 
-    if (uMode == 5) {
-        vec3 normal = normalize(fNormal);
-        vec3 lightDir = normalize(uSunDir);
-        
-        float ambient = 0.05; 
-        float diff = max(dot(normal, lightDir), 0.0);
+	vec3 normal = normalize(fNormal);
+	vec3 lightDir = normalize(uSunDir);
 
-        vec3 viewDir = normalize(uCameraPos - fWorldPos);
-        vec3 reflectDir = reflect(-lightDir, normal);  
+	float diff = max(dot(normal, lightDir), 0.0);
 
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 8.0f);
-        vec3 specularColor = vec3(0.2) * spec; 
+	vec3 viewDir = normalize(uCameraPos - fWorldPos);
+	vec3 reflectDir = reflect(-lightDir, normal);
 
-        vec4 fragPosLightSpace = uLightSpaceMatrix * vec4(fWorldPos, 1.0);
-        vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-        vec3 shadowUV = projCoords * 0.5 + 0.5;
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), 8.0f);
+	vec3 specularColor = vec3(0.2) * spec;
 
-        float currentDepth = projCoords.z;
-        float shadow = 0.0;
-        float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.0005); 
+	float shadow = ShadowFactor(normal, lightDir);
 
-        if (projCoords.z > 1.0 || shadowUV.x < 0.0 || shadowUV.x > 1.0 || shadowUV.y < 0.0 || shadowUV.y > 1.0) {
-            shadow = 0.0; 
-        } else { 
-            vec2 texelSize = 1.0 / textureSize(tShadowMap, 0);
-            for(int x = -2; x <= 2; ++x) {
-                for(int y = -2; y <= 2; ++y) {
-                    float pcfDepth = texture(tShadowMap, shadowUV.xy + vec2(x, y) * texelSize).r;
-                    shadow += (currentDepth - bias) > pcfDepth ? 1.0 : 0.0;
-                }
-            }
-            shadow /= 25.0;
-        }
+	float ambientStrength = 0.15;
+	vec3 ambientLight = ambientStrength * vec3(1.0);
 
+	vec3 diffuseLight = (1.0 - shadow) * (diff * vec3(1.0));
 
-        float ambientStrength = 0.15; 
-        vec3 ambientLight = ambientStrength * vec3(1.0);
+	vec3 specularLight = (1.0 - shadow) * specularColor;
 
-        vec3 diffuseLight = (1.0 - shadow) * (diff * vec3(1.0));
+	vec3 finalLight = (ambientLight + diffuseLight);
+	vec3 result = finalLight * texColor.rgb + specularLight;
 
-        vec3 specularLight = (1.0 - shadow) * specularColor;
-        
-        vec3 finalLight = (ambientLight + diffuseLight); 
-        vec3 result = finalLight * texColor.rgb + specularLight;
+	fboColor = vec4(result, texColor.a);
 
-        fboColor = vec4(result, texColor.a);
-    }
+#else
+	#error "No shading variant is defined!"
+#endif
 }
@@ -10,6 +10,13 @@
 
 		It supports custom per-vertex normals
 		and texture (uv) coordinates.
+
+		SHADOW_DEPTH variant only outputs the world
+		space position, "shadow.geom" projects it to
+		each cascade. Shadow pass has no fragment stage.
+
+		TESSELLATED variant does the same for the patch
+		corners, "planet.tesc/tese" generate the surface.
 */
 
 
@@ -23,13 +30,11 @@
 #define OUT_NORMAL		layout(location = 1)
 #define OUT_COLOR		layout(location = 2)
 #define OUT_WORLD_POS   layout(location = 3) 
-#define OUT_DEPTH       layout(location = 4) // added for shadow
 
 #define U_TRANSFORM_MODEL   layout(location = 0)
 #define U_TRANSFORM_VIEW    layout(location = 1)
 #define U_TRANSFORM_PROJ    layout(location = 2)
 #define U_TRANSFORM_NORMAL  layout(location = 3)
-#define U_MODE              layout(location = 4) // added for shadow
 
 // Input
 in IN_POS	 vec3 vPos;
@@ -41,29 +46,38 @@ in IN_UV	 vec2 vUV;
 // This is mandatory since we are using modern pipeline
 out gl_PerVertex {vec4 gl_Position;};
 
+#if defined(SHADOW_DEPTH) || defined(TESSELLATED)
+	#define WORLD_POS_ONLY
+#endif
+
 // These pass through to rasterizer and will be iterpolated at
 // fragment positions
+#ifndef WORLD_POS_ONLY
 out OUT_UV		vec2 fUV;
 out OUT_NORMAL	vec3 fNormal;
 out OUT_WORLD_POS vec3 fWorldPos; 
-out OUT_DEPTH   float fDepth;    // This is the main focus for shadows
+#endif
 
 // Uniforms
 U_TRANSFORM_MODEL	uniform mat4 uModel;
+#ifndef WORLD_POS_ONLY
 U_TRANSFORM_VIEW	uniform mat4 uView;
 U_TRANSFORM_PROJ	uniform mat4 uProjection;
 U_TRANSFORM_NORMAL  uniform mat3 uNormalMatrix;
-U_MODE              uniform uint uMode; 
+#endif
 
 void main(void)
 {
-	fUV = vUV;
-	fNormal = normalize(uNormalMatrix * vNormal);
-	
 	vec4 worldPos = uModel * vec4(vPos, 1.0f);
-	fWorldPos = worldPos.xyz;
+
+#ifdef WORLD_POS_ONLY
+	gl_Position = worldPos;
+#else
 	// Rasterizer
 	gl_Position = uProjection * uView * worldPos;
-	
-	fDepth = gl_Position.z;
+
+	fUV = vUV;
+	fNormal = normalize(uNormalMatrix * vNormal);
+	fWorldPos = worldPos.xyz;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#version 430
+/*
+	File Name	: impostor.vert
+	Description	:
+
+		Camera facing quad of a ray-cast sphere impostor,
+		vertices are generated from gl_VertexID (triangle
+		strip, no vertex buffers).
+
+		Quad lies on the plane that touches the sphere at
+		its nearest point and bounds the silhouette cone,
+		so every ray-cast depth is behind the quad (see the
+		"depth_less" of "debug.frag", depth is reversed).
+		Fragment stage ("IMPOSTOR" variants of "debug.frag")
+		intersects the view ray through "fWorldPos".
+*/
+
+
+// Definitions
+#define OUT_WORLD_POS		layout(location = 3)
+
+#define U_SPHERE			layout(location = 0) // xyz: world center, w: radius
+#define U_TRANSFORM_VIEW	layout(location = 1)
+#define U_TRANSFORM_PROJ	layout(location = 2)
+
+// Output
+out gl_PerVertex {vec4 gl_Position;};
+
+out OUT_WORLD_POS vec3 fWorldPos;
+
+// Uniforms
+U_SPHERE			uniform vec4 uSphere;
+U_TRANSFORM_VIEW	uniform mat4 uView;
+U_TRANSFORM_PROJ	uniform mat4 uProjection;
+
+void main(void)
+{
+	// (-1, -1), (1, -1), (-1, 1), (1, 1)
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+	// View matrix is rigid, inverse translation is the camera position
+	vec3 cameraPos = -(transpose(mat3(uView)) * uView[3].xyz);
+	vec3 toCenter  = uSphere.xyz - cameraPos;
+	float dist     = length(toCenter);
+	vec3 forward   = toCenter / dist;
+	vec3 up        = (abs(forward.y) < 0.999) ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+	vec3 right     = normalize(cross(forward, up));
+	up = cross(right, forward);
+
+	// Silhouette cone (half angle asin(r / d)) at the tangent plane
+	float r         = uSphere.w;
+	float planeDist = dist - r;
+	float extent    = planeDist * r / sqrt(max(dist * dist - r * r, 1e-6));
+
+	vec3 worldPos = cameraPos + forward * planeDist +
+					(right * corner.x + up * corner.y) * extent;
+	gl_Position = uProjection * uView * vec4(worldPos, 1.0);
+	fWorldPos   = worldPos;
+}
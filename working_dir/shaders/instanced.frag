@@ -0,0 +1,57 @@
+#version 430
+/*
+	File Name	: instanced.frag
+	Description	:
+
+		Lit shading of instanced small bodies.
+		Albedo comes from a texture array layer,
+		shading parameters come per instance.
+*/
+
+
+// Definitions
+#define IN_UV        layout(location = 0)
+#define IN_NORMAL    layout(location = 1)
+#define IN_WORLD_POS layout(location = 3)
+#define IN_LAYER     layout(location = 5)
+#define IN_SHADING   layout(location = 6)
+
+#define OUT_FBO      layout(location = 0)
+
+#define T_ALBEDO     layout(binding = 0)
+
+#define U_SUN_DIR    layout(location = 1)
+#define U_CAMERA_POS layout(location = 2)
+
+// Input
+in IN_UV        vec2 fUV;
+in IN_NORMAL    vec3 fNormal;
+in IN_WORLD_POS vec3 fWorldPos;
+in IN_LAYER flat uint fLayer;
+in IN_SHADING flat vec3 fShading; // ambient, specular, shininess
+
+// Output
+out OUT_FBO vec4 fboColor;
+
+// Uniforms
+U_SUN_DIR    uniform vec3 uSunDir;
+U_CAMERA_POS uniform vec3 uCameraPos;
+
+// Textures
+uniform T_ALBEDO sampler2DArray tAlbedo;
+
+void main(void)
+{
+	vec3 texColor = texture(tAlbedo, vec3(fUV, float(fLayer))).rgb;
+
+	vec3 normal   = normalize(fNormal);
+	vec3 lightDir = normalize(uSunDir);
+	vec3 viewDir  = normalize(uCameraPos - fWorldPos);
+	vec3 halfDir  = normalize(lightDir + viewDir);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+	float spec = (diff > 0.0) ? pow(max(dot(normal, halfDir), 0.0), fShading.z) : 0.0;
+
+	vec3 result = (fShading.x + diff) * texColor + vec3(fShading.y * spec);
+	fboColor = vec4(result, 1.0);
+}
@@ -0,0 +1,79 @@
+#version 430
+/*
+	File Name	: instanced.vert
+	Description	:
+
+		Instanced vertex transform shader for large
+		body populations (asteroid belts, ring particles).
+		Per-instance transform and shading parameters are
+		fetched from an SSBO via "gl_InstanceID".
+*/
+
+
+// Definitions
+#define IN_POS			layout(location = 0)
+#define IN_NORMAL		layout(location = 1)
+#define IN_UV			layout(location = 2)
+
+#define OUT_UV			layout(location = 0)
+#define OUT_NORMAL		layout(location = 1)
+#define OUT_WORLD_POS   layout(location = 3)
+#define OUT_LAYER       layout(location = 5)
+#define OUT_SHADING     layout(location = 6)
+
+#define U_TRANSFORM_MODEL   layout(location = 0) // Parent frame of all instances
+#define U_TRANSFORM_VIEW    layout(location = 1)
+#define U_TRANSFORM_PROJ    layout(location = 2)
+
+// This must match InstancedBodiesGL::SSBO_INSTANCES
+#define SSBO_INSTANCES      layout(std430, binding = 0)
+
+struct BodyInstance
+{
+	mat4	transform;
+	uint	layer;
+	float	ambient;
+	float	specular;
+	float	shininess;
+};
+
+// Input
+in IN_POS	 vec3 vPos;
+in IN_NORMAL vec3 vNormal;
+in IN_UV	 vec2 vUV;
+
+SSBO_INSTANCES readonly buffer InstanceBuffer
+{
+	BodyInstance instances[];
+};
+
+// Output
+out gl_PerVertex {vec4 gl_Position;};
+
+out OUT_UV			vec2 fUV;
+out OUT_NORMAL		vec3 fNormal;
+out OUT_WORLD_POS	vec3 fWorldPos;
+out OUT_LAYER flat	uint fLayer;
+out OUT_SHADING flat vec3 fShading;
+
+// Uniforms
+U_TRANSFORM_MODEL	uniform mat4 uModel;
+U_TRANSFORM_VIEW	uniform mat4 uView;
+U_TRANSFORM_PROJ	uniform mat4 uProjection;
+
+void main(void)
+{
+	BodyInstance inst = instances[gl_InstanceID];
+	mat4 model = uModel * inst.transform;
+
+	fUV = vUV;
+	// Instances are uniformly scaled, so the upper 3x3 of the model
+	// matrix is a valid normal matrix (up to normalization).
+	fNormal = normalize(mat3(model) * vNormal);
+	fLayer = inst.layer;
+	fShading = vec3(inst.ambient, inst.specular, inst.shininess);
+
+	vec4 worldPos = model * vec4(vPos, 1.0f);
+	fWorldPos = worldPos.xyz;
+	gl_Position = uProjection * uView * worldPos;
+}
@@ -0,0 +1,36 @@
+#version 430
+/*
+	File Name	: sky.frag
+	Description	:
+
+		Samples the sky cubemap with the view ray
+		reconstructed by "sky.vert". Cubemap is converted
+		from the equirectangular image at load time
+		("equirect_cube.comp"), so the mapping is the same
+		as the UVs of the sphere meshes.
+*/
+
+
+// Definitions
+#define IN_VIEW_RAY	layout(location = 0)
+
+// This output must match to the COLOR_ATTACHMENTi (where 'i' is this location)
+#define OUT_FBO		layout(location = 0)
+
+// This must match GL_TEXTUREi (where 'i' is this binding)
+#define T_SKY		layout(binding = 0)
+
+// Input
+noperspective in IN_VIEW_RAY vec3 fViewRay;
+
+// Output
+out OUT_FBO vec4 fboColor;
+
+// Textures
+uniform T_SKY samplerCube tSky;
+
+void main(void)
+{
+	// No seam, implicit derivatives select the mip
+	fboColor = texture(tSky, fViewRay);
+}
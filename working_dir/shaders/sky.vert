@@ -0,0 +1,43 @@
+#version 430
+/*
+	File Name	: sky.vert
+	Description	:
+
+		Fullscreen triangle of the sky pass, vertices are
+		generated from gl_VertexID (no vertex buffers).
+
+		Triangle is placed on the (infinite) far plane, depth
+		0 with reverse-Z, so with GL_GEQUAL depth test only the
+		pixels that are not covered by the opaque geometry
+		are shaded.
+		World space view ray of each corner is interpolated
+		linearly in screen space ("noperspective").
+*/
+
+
+// Definitions
+#define OUT_VIEW_RAY		layout(location = 0)
+
+#define U_INV_VIEW_PROJ		layout(location = 0)
+
+// Output
+out gl_PerVertex {vec4 gl_Position;};
+
+noperspective out OUT_VIEW_RAY vec3 fViewRay;
+
+// Uniforms
+// Inverse of the projection * view (without the translation)
+U_INV_VIEW_PROJ uniform mat4 uInvViewProj;
+
+void main(void)
+{
+	// (-1, -1), (3, -1), (-1, 3) covers the viewport
+	vec2 ndc = vec2(float((gl_VertexID & 1) << 2) - 1.0,
+					float((gl_VertexID & 2) << 1) - 1.0);
+	gl_Position = vec4(ndc, 0.0, 1.0);
+
+	// Far plane is at infinity (w = 0), the ray goes through the near
+	// plane instead (camera is at the origin, only the direction is used)
+	vec4 nearPoint = uInvViewProj * vec4(ndc, 1.0, 1.0);
+	fViewRay = nearPoint.xyz / nearPoint.w;
+}
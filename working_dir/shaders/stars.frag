@@ -0,0 +1,28 @@
+#version 430
+/*
+	File Name	: stars.frag
+	Description	:
+
+		Gaussian profile of a star sprite, accumulated
+		with additive blending over the sky glow.
+*/
+
+
+// Definitions
+#define IN_COLOR	layout(location = 0)
+
+// This output must match to the COLOR_ATTACHMENTi (where 'i' is this location)
+#define OUT_FBO		layout(location = 0)
+
+// Input
+in IN_COLOR flat vec3 fColor;
+
+// Output
+out OUT_FBO vec4 fboColor;
+
+void main(void)
+{
+	vec2 r = gl_PointCoord * 2.0 - 1.0;
+	float falloff = exp(-4.0 * dot(r, r));
+	fboColor = vec4(fColor * falloff, 1.0);
+}
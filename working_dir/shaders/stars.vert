@@ -0,0 +1,71 @@
+#version 430
+/*
+	File Name	: stars.vert
+	Description	:
+
+		Point sprites of the star catalog, one vertex per
+		star pulled from an SSBO via "gl_VertexID".
+
+		Stars are placed on the far plane (depth 0, drawn
+		with GL_GEQUAL like the sky). Sprite size is in pixels
+		and grows with the flux, stars that would be smaller
+		than "MIN_SIZE" are dimmed instead, so the catalog
+		does not blur or flicker when the FOV changes.
+*/
+
+
+// Definitions
+#define OUT_COLOR			layout(location = 0)
+
+#define U_VIEW_PROJ			layout(location = 0)
+
+// This must match StarFieldGL::SSBO_STARS
+#define SSBO_STARS			layout(std430, binding = 0)
+
+// Sprite diameter (in pixels) of the brightest star (magnitude 0)
+#define MAX_SIZE			6.0
+#define MIN_SIZE			1.5
+
+struct Star
+{
+	vec3	direction;
+	uint	color;		// RGB8 color, A8 is magnitude * 10
+};
+
+SSBO_STARS readonly buffer StarBuffer
+{
+	Star stars[];
+};
+
+// Output
+out gl_PerVertex
+{
+	vec4  gl_Position;
+	float gl_PointSize;
+};
+
+out OUT_COLOR flat vec3 fColor;
+
+// Uniforms
+// Projection * view (without the translation)
+U_VIEW_PROJ uniform mat4 uViewProj;
+
+void main(void)
+{
+	Star star   = stars[gl_VertexID];
+	vec4 color  = unpackUnorm4x8(star.color);
+	float flux  = pow(10.0, -0.4 * color.a * 25.5);
+
+	// Sprite area is proportional to the flux
+	float size      = MAX_SIZE * sqrt(flux);
+	float intensity = 1.0;
+	if (size < MIN_SIZE) {
+		intensity = (size * size) / (MIN_SIZE * MIN_SIZE);
+		size      = MIN_SIZE;
+	}
+
+	vec4 clip    = uViewProj * vec4(star.direction, 1.0);
+	gl_Position  = vec4(clip.xy, 0.0, clip.w);
+	gl_PointSize = size;
+	fColor       = color.rgb * intensity;
+}
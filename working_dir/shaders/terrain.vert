@@ -0,0 +1,113 @@
+#version 430
+/*
+	File Name	: terrain.vert
+	Description	:
+
+		Displaces the shared grid of the terrain chunks
+		(instances, fetched from an SSBO via "gl_InstanceID")
+		onto the planet surface. Odd grid vertices slide onto
+		the even ones as the chunk gets farther (CDLOD morph),
+		so the grid matches the parent's when it is merged.
+
+		Heights & normals come from the tile array, texels
+		are at the grid vertices. Outputs are the same as
+		"planet.tese" (TESSELLATED variant of "debug.frag").
+*/
+
+
+// Definitions
+#define IN_POS				layout(location = 0) // xy: grid vertex, z: 1 on the skirt
+
+#define OUT_NORMAL			layout(location = 1)
+#define OUT_WORLD_POS		layout(location = 3)
+#define OUT_OBJECT_DIR		layout(location = 4)
+
+#define U_TRANSFORM_MODEL	layout(location = 0)
+#define U_TRANSFORM_VIEW	layout(location = 1)
+#define U_TRANSFORM_PROJ	layout(location = 2)
+#define U_CAMERA_OBJECT		layout(location = 3) // Camera position in object space
+#define U_HEIGHT_SCALE		layout(location = 4)
+
+// These must match TerrainGL::GRID, SSBO_CHUNKS & T_TILES
+#define GRID				32.0
+#define SSBO_CHUNKS			layout(std430, binding = 0)
+#define T_TILES				layout(binding = 6)
+
+#define PI 3.14159265358979
+
+struct TerrainChunk
+{
+	vec2	origin;
+	float	size;
+	uint	face;
+	float	morphStart;
+	float	morphEnd;
+	uint	layer;
+	float	skirtDepth;
+};
+
+// Input
+in IN_POS vec3 vPos;
+
+SSBO_CHUNKS readonly buffer ChunkBuffer
+{
+	TerrainChunk chunks[];
+};
+
+// Output
+out gl_PerVertex {vec4 gl_Position;};
+
+out OUT_NORMAL		vec3 fNormal;
+out OUT_WORLD_POS	vec3 fWorldPos;
+out OUT_OBJECT_DIR	vec3 fObjectDir;
+
+// Uniforms
+uniform T_TILES sampler2DArray tTiles;
+
+U_TRANSFORM_MODEL	uniform mat4 uModel;
+U_TRANSFORM_VIEW	uniform mat4 uView;
+U_TRANSFORM_PROJ	uniform mat4 uProjection;
+U_CAMERA_OBJECT		uniform vec3 uCameraObject;
+U_HEIGHT_SCALE		uniform float uHeightScale;
+
+// Face order & orientation of the cubemaps, warped to equal angles.
+// This must match "CubeToSphere" at "terrain.cpp".
+vec3 CubeToSphere(uint face, vec2 st)
+{
+	st = tan(st * (PI * 0.25));
+	vec3 p;
+	switch (face) {
+		case 0:  p = vec3( 1.0,  -st.y, -st.x); break;
+		case 1:  p = vec3(-1.0,  -st.y,  st.x); break;
+		case 2:  p = vec3( st.x,  1.0,   st.y); break;
+		case 3:  p = vec3( st.x, -1.0,  -st.y); break;
+		case 4:  p = vec3( st.x, -st.y,  1.0);  break;
+		default: p = vec3(-st.x, -st.y, -1.0);  break;
+	}
+	return normalize(p);
+}
+
+void main(void)
+{
+	TerrainChunk chunk = chunks[gl_InstanceID];
+
+	// Morph by the distance of the undisplaced vertex, so the vertices
+	// on a shared edge get the same factor on both chunks
+	vec2  grid  = vPos.xy;
+	vec3  dir   = CubeToSphere(chunk.face, chunk.origin + grid / GRID * chunk.size);
+	float morph = clamp((distance(dir, uCameraObject) - chunk.morphStart) /
+						(chunk.morphEnd - chunk.morphStart), 0.0, 1.0);
+	grid -= fract(grid * 0.5) * 2.0 * morph;
+	dir   = CubeToSphere(chunk.face, chunk.origin + grid / GRID * chunk.size);
+
+	// Texel centers are at the grid vertices, morphed ones are interpolated
+	vec4 tile = textureLod(tTiles, vec3((grid + 0.5) / (GRID + 1.0), float(chunk.layer)), 0.0);
+	float radius = 1.0 + tile.w * uHeightScale - vPos.z * chunk.skirtDepth;
+
+	vec4 worldPos = uModel * vec4(dir * radius, 1.0);
+	// Scale is uniform, the upper 3x3 is a valid normal matrix
+	fNormal     = normalize(mat3(uModel) * tile.xyz);
+	fWorldPos   = worldPos.xyz;
+	fObjectDir  = dir;
+	gl_Position = uProjection * uView * worldPos;
+}